@@ -1,4 +1,12 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <opencv2/core.hpp>
@@ -7,25 +15,31 @@
 
 #include "envitools/Box.hpp"
 #include "envitools/CSVIO.hpp"
-#include "envitools/ContrastMetrics.hpp"
+#include "envitools/ContrastEngine.hpp"
+#include "envitools/ENVI.hpp"
 #include "envitools/EnviUtils.hpp"
 
 namespace fs = boost::filesystem;
 namespace po = boost::program_options;
 namespace et = envitools;
-namespace cm = et::ContrastMetrics;
+
+void ParallelFor(
+    size_t count, unsigned threads, const std::function<void(size_t)>& f);
 
 int main(int argc, char* argv[])
 {
     ///// Parse the cmd line /////
-    fs::path imgDir, csvPath, forePtsPath, backPtsPath, roiPath;
+    fs::path imgDir, enviPath, csvPath, forePtsPath, backPtsPath, roiPath;
 
     // clang-format off
     po::options_description options("Options");
     options.add_options()
         ("help,h","Show this message")
-        ("input-dir,i",po::value<std::string>()->required(),
+        ("input-dir,i",po::value<std::string>(),
             "Input directory of wavelengths")
+        ("envi,e",po::value<std::string>(),
+            "Path to an ENVI header. Contrast is computed from every band of "
+            "the cube instead of from an input directory.")
         ("foreground-pts,f",po::value<std::string>(),
             "Ink points for Michelson")
         ("background-pts,b",po::value<std::string>(),
@@ -33,7 +47,13 @@ int main(int argc, char* argv[])
         ("roi,r",po::value<std::string>(),
             "Region of interest for RMS contrast")
         ("output-file,o", po::value<std::string>()->required(),
-            "Output file path");
+            "Output file path")
+        ("max-memory,m", po::value<size_t>()->default_value(4096),
+            "Maximum memory (in MB) used to hold bands read in a single pass "
+            "over BIP and BIL files")
+        ("threads,t", po::value<unsigned>()->default_value(
+            std::max(1u, std::thread::hardware_concurrency())),
+            "Number of wavelengths processed in parallel");
     // clang-format on
 
     // parsedOptions will hold the values of all parsed options as a Map
@@ -56,6 +76,14 @@ int main(int argc, char* argv[])
         return EXIT_FAILURE;
     }
 
+    // Need exactly one source of wavelengths
+    auto useENVI = parsedOptions.count("envi") > 0;
+    if (useENVI == (parsedOptions.count("input-dir") > 0)) {
+        std::cerr << "ERROR: Provide either an input directory or an ENVI file"
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
     // Do we have the options to calculate contrast?
     auto doMichelson = parsedOptions.count("foreground-pts") > 0 &&
                        parsedOptions.count("background-pts") > 0;
@@ -70,13 +98,23 @@ int main(int argc, char* argv[])
     // Get the output path
     csvPath = parsedOptions["output-file"].as<std::string>();
 
-    ///// Collect the tif files /////
-    imgDir = parsedOptions["input-dir"].as<std::string>();
-    std::vector<fs::path> imgPaths = et::FindByExtension(imgDir, ".tif");
-    if (imgPaths.empty()) {
-        std::cerr << "Error opening/parsing image directory. No files found."
-                  << std::endl;
-        return EXIT_FAILURE;
+    ///// Collect the wavelengths /////
+    std::vector<fs::path> imgPaths;
+    if (useENVI) {
+        enviPath = parsedOptions["envi"].as<std::string>();
+        if (!fs::exists(enviPath)) {
+            std::cerr << "ENVI file does not exist" << std::endl;
+            return EXIT_FAILURE;
+        }
+    } else {
+        imgDir = parsedOptions["input-dir"].as<std::string>();
+        imgPaths = et::FindByExtension(imgDir, ".tif");
+        if (imgPaths.empty()) {
+            std::cerr
+                << "Error opening/parsing image directory. No files found."
+                << std::endl;
+            return EXIT_FAILURE;
+        }
     }
 
     ///// Setup Michelson Points and Regions ////
@@ -107,46 +145,122 @@ int main(int argc, char* argv[])
     }
 
     ///// Calculate contrast /////
-    std::map<std::string, std::vector<double>> perWavelengthResults;
-    std::vector<double> contrasts;
-    cv::Mat image;
+    // Images are converted to floating point. The engine tone maps the
+    // sampled pixels to a reasonable scale.
+    et::ContrastEngine engine(forePts, backPts, rmsBoxes, float(2.2));
     std::cout << "Calculating contrast metrics..." << std::endl;
-    for (auto path : imgPaths) {
-        // Reset temp storage
-        contrasts.clear();
 
-        // Get wavelength for key
-        auto id = et::ParseWavelength(path);
+    // Wavelengths are processed independently by a pool of threads. Results
+    // are stored by wavelength index and merged in order afterwards, so the
+    // output is the same as a serial run.
+    auto threads = std::max(1u, parsedOptions["threads"].as<unsigned>());
+    std::vector<std::string> ids;
+    std::vector<std::vector<double>> results;
+    std::vector<char> loaded;
+
+    // Guards console output
+    std::mutex consoleMutex;
+    auto report = [&consoleMutex](const std::string& id) {
+        std::lock_guard<std::mutex> lock(consoleMutex);
         std::cerr << "Wavelength: " << id << "\r";
+    };
 
-        // Load the image
-        image = cv::imread(path.string(), -1);
-        if (image.empty()) {
-            std::cout << "Could not open or find the image: ";
-            std::cout << path.string() << std::endl;
-            continue;
+    if (useENVI) {
+        // Read bands straight from the cube, skipping the extracted images
+        et::ENVI envi(enviPath);
+        envi.setAccessMode(et::ENVI::AccessMode::KeepOpen);
+        auto bands = static_cast<size_t>(envi.bands());
+        ids = envi.getWavelengths();
+        // Bands without a wavelength are named by index. Extra wavelengths
+        // are ignored.
+        for (auto b = ids.size(); b < bands; b++) {
+            ids.push_back(std::to_string(b));
         }
+        ids.resize(bands);
+        results.resize(bands);
+        loaded.resize(bands, 0);
 
-        // Images are floating point. Tone map them to a reasonable scale
-        image = et::ToneMap(image, float(2.2));
-
-        // Michelson Contrast
-        if (doMichelson) {
-            contrasts.push_back(cm::MichelsonContrast(image, forePts, backPts));
+        // Workers read their own bands from BSQ files. Bands in BIP and BIL
+        // files are read in batches which fit in memory, one pass over the
+        // data file per batch, and are then shared out to the workers.
+        auto bsq = envi.interleave() == et::ENVI::Interleave::BandSequential;
+        auto batchSize = bands;
+        if (!bsq) {
+            auto maxBytes = parsedOptions["max-memory"].as<size_t>() << 20;
+            batchSize = envi.bandsPerBatch(maxBytes);
         }
 
-        // RMS Contrast
-        if (doRMS) {
-            for (auto box : rmsBoxes) {
-                contrasts.push_back(cm::RMSContrast(image, box));
+        for (size_t start = 0; start < bands; start += batchSize) {
+            auto end = std::min(start + batchSize, bands);
+            std::vector<int> batch;
+            for (auto b = start; b < end; b++) {
+                batch.push_back(static_cast<int>(b));
             }
+
+            std::vector<cv::Mat> mats;
+            if (!bsq) {
+                mats = envi.getBands(batch);
+            }
+
+            ParallelFor(batch.size(), threads, [&](size_t i) {
+                auto b = static_cast<size_t>(batch[i]);
+                report(ids[b]);
+
+                // Convert to float while reading, or from the batch
+                cv::Mat band;
+                if (bsq) {
+                    band = envi.getBand(batch[i], CV_32F);
+                } else {
+                    mats[i].convertTo(band, CV_32F);
+                    mats[i].release();
+                }
+
+                // Michelson and RMS contrast, in a single pass over the
+                // samples
+                results[b] = engine.evaluate(band);
+                loaded[b] = 1;
+            });
         }
 
-        // Add to the map
-        perWavelengthResults[id] = contrasts;
+        // Make sure the file gets closed
+        envi.closeFile();
+    } else {
+        // Get wavelength for key
+        for (const auto& path : imgPaths) {
+            ids.push_back(et::ParseWavelength(path));
+        }
+        results.resize(imgPaths.size());
+        loaded.resize(imgPaths.size(), 0);
+
+        ParallelFor(imgPaths.size(), threads, [&](size_t i) {
+            const auto& path = imgPaths[i];
+            report(ids[i]);
+
+            // Load the image
+            auto image = cv::imread(path.string(), -1);
+            if (image.empty()) {
+                std::lock_guard<std::mutex> lock(consoleMutex);
+                std::cout << "Could not open or find the image: ";
+                std::cout << path.string() << std::endl;
+                return;
+            }
+
+            // Michelson and RMS contrast, in a single pass over the samples
+            results[i] = engine.evaluate(image);
+            loaded[i] = 1;
+        });
     }
     std::cout << std::endl;
 
+    // Merge in order. Later wavelengths replace earlier ones with the same
+    // name, as in a serial run.
+    std::map<std::string, std::vector<double>> perWavelengthResults;
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (loaded[i] != 0) {
+            perWavelengthResults[ids[i]] = std::move(results[i]);
+        }
+    }
+
     ///// Make the CSV header /////
     std::vector<std::string> header;
     header.emplace_back("wavelength");
@@ -167,3 +281,41 @@ int main(int argc, char* argv[])
     std::cout << "Done." << std::endl;
     return 0;
 }
+
+// Call f for every index in [0, count) on a pool of threads. The first error
+// stops every thread and is rethrown.
+void ParallelFor(
+    size_t count, unsigned threads, const std::function<void(size_t)>& f)
+{
+    std::atomic<size_t> next{0};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+
+    auto process = [&]() {
+        for (auto i = next++; i < count; i = next++) {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = count;
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(process);
+    }
+    process();
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -82,6 +82,7 @@ int main(int argc, char* argv[])
     std::cout << "Samples (Width): " << envi->width() << std::endl;
     std::cout << "Lines (Height): " << envi->height() << std::endl;
     std::cout << "Bands (Depth): " << envi->bands() << std::endl;
+    std::cout << "Header offset: " << envi->headerOffset() << std::endl;
 
     // Print Band IDs
     std::cout << "Band ID count: " << envi->getWavelengths().size()
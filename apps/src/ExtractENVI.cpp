@@ -2,7 +2,13 @@
 // Created by Seth Parker on 2/7/17.
 //
 
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <set>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
@@ -10,6 +16,7 @@
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
 
+#include "envitools/BoundedQueue.hpp"
 #include "envitools/ENVI.hpp"
 #include "envitools/TIFFIO.hpp"
 
@@ -18,6 +25,17 @@ namespace fs = boost::filesystem;
 namespace po = boost::program_options;
 
 std::vector<int> OptToBandList(const std::string& opt);
+void WriteBand(
+    const fs::path& outputDir,
+    const std::string& id,
+    cv::Mat m,
+    unsigned threads);
+
+// A band image waiting to be written
+struct BandJob {
+    std::string id;
+    cv::Mat image;
+};
 
 int main(int argc, char** argv)
 {
@@ -33,7 +51,17 @@ int main(int argc, char** argv)
             "(e.g. \"0,56,27,133\"). If \"all\", program will extract all bands"
             " to the output directory.")
         ("output-dir,o", po::value<std::string>()->required(),
-            "Output directory");
+            "Output directory. Complex bands are written as two images, "
+            "suffixed _real and _imag.")
+        ("stack,s", "Write every band as a page of one BigTIFF in the output "
+            "directory, named after the input file, instead of one file per "
+            "band. Each page's description is the band's wavelength.")
+        ("max-memory,m", po::value<size_t>()->default_value(4096),
+            "Maximum memory (in MB) used to hold bands read in a single pass "
+            "over BIP and BIL files")
+        ("threads,t", po::value<unsigned>()->default_value(
+            std::max(1u, std::thread::hardware_concurrency())),
+            "Number of threads used to encode and write bands");
     // clang-format on
 
     po::variables_map parsedOptions;
@@ -85,39 +113,192 @@ int main(int argc, char** argv)
     else {
         bandsVec = OptToBandList(bandsOpt);
         std::sort(bandsVec.begin(), bandsVec.end());
+        bandsVec.erase(
+            std::unique(bandsVec.begin(), bandsVec.end()), bandsVec.end());
     }
 
-    ///// Do the processing /////
-    // Prep the ENVI file for continuous access
-    envi.setAccessMode(et::ENVI::AccessMode::KeepOpen);
-
-    // Extract each band
-    for (auto& band : bandsVec) {
+    // Remove bands that aren't in the file
+    auto inRange = [&envi](int band) {
         if (band < 0 || band >= envi.bands()) {
             std::cerr << "Error: Band (" << band << ") not in range. Skipping."
                       << std::endl;
-            continue;
+            return false;
         }
+        return true;
+    };
+    bandsVec.erase(
+        std::stable_partition(bandsVec.begin(), bandsVec.end(), inRange),
+        bandsVec.end());
 
-        // Get band from file
-        auto m = envi.getBand(band);
+    // Bands are written to files named after their wavelength. Writers run
+    // concurrently, so only the last band with each name is written, which
+    // is the file a serial run would leave behind.
+    if (parsedOptions.count("stack") == 0) {
+        std::set<std::string> names;
+        std::vector<int> uniqueBands;
+        for (auto it = bandsVec.rbegin(); it != bandsVec.rend(); ++it) {
+            auto id = envi.getWavelength(*it);
+            if (!names.insert(id).second) {
+                std::cerr << "Error: Band (" << *it << ") has the same "
+                          << "wavelength as a later band (" << id
+                          << "). Skipping." << std::endl;
+                continue;
+            }
+            uniqueBands.push_back(*it);
+        }
+        bandsVec.assign(uniqueBands.rbegin(), uniqueBands.rend());
+    }
 
-        // Select file extension
-        fs::path out = outputDir / (envi.getWavelength(band) + ".png");
+    ///// Do the processing /////
+    // Prep the ENVI file for continuous access
+    envi.setAccessMode(et::ENVI::AccessMode::KeepOpen);
 
-        if (m.depth() == CV_16U || m.depth() == CV_32F || m.depth() == CV_64F) {
-            out.replace_extension("tif");
-        }
+    // Bands in BIP and BIL files are read in batches which fit in memory.
+    // Every batch costs one pass over the data file.
+    size_t batchSize = 1;
+    if (envi.interleave() != et::ENVI::Interleave::BandSequential) {
+        auto maxBytes = parsedOptions["max-memory"].as<size_t>() << 20;
+        batchSize = envi.bandsPerBatch(maxBytes);
+    }
+
+    // Bands are read on this thread and handed to a pool of writers. The
+    // queue holds at most one band per writer, which bounds memory use.
+    auto threads = std::max(1u, parsedOptions["threads"].as<unsigned>());
+
+    // Pages of a stack are written in order by a single writer, which uses
+    // every thread to compress each page
+    std::unique_ptr<et::TIFFIO::StackWriter> stack;
+    if (parsedOptions.count("stack") > 0) {
+        auto stackPath = outputDir / (enviPath.stem().string() + ".tif");
+        et::TIFFIO::WriteOptions opts;
+        opts.threads = threads;
+        stack.reset(new et::TIFFIO::StackWriter(stackPath, opts));
+    }
+    auto writerCount = stack ? 1u : threads;
+    et::BoundedQueue<BandJob> queue(writerCount);
+
+    // Threads left over when there are fewer bands than writers are used to
+    // compress each band's strips in parallel
+    auto bandCount = std::max<size_t>(1, bandsVec.size());
+    auto compressThreads = static_cast<unsigned>(std::max<size_t>(
+        1, threads / std::min<size_t>(writerCount, bandCount)));
+
+    // Only the first writer error is reported
+    std::exception_ptr writeError;
+    std::mutex errorMutex;
+
+    std::vector<std::thread> writers;
+    for (unsigned t = 0; t < writerCount; t++) {
+        writers.emplace_back([&]() {
+            BandJob job;
+            while (queue.pop(job)) {
+                try {
+                    if (stack) {
+                        stack->writePage(job.image, job.id);
+                    } else {
+                        WriteBand(
+                            outputDir, job.id, job.image, compressThreads);
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!writeError) {
+                        writeError = std::current_exception();
+                    }
+                    queue.close();
+                }
+                job.image.release();
+            }
+        });
+    }
 
-        if (m.depth() == CV_32F || m.depth() == CV_64F) {
-            et::TIFFIO::WriteTIFF(out, m);
-        } else {
-            cv::imwrite(out.string(), m);
+    // Extract each batch of bands
+    try {
+        for (size_t start = 0; start < bandsVec.size(); start += batchSize) {
+            auto end = std::min(start + batchSize, bandsVec.size());
+            std::vector<int> batch(
+                bandsVec.begin() + static_cast<std::ptrdiff_t>(start),
+                bandsVec.begin() + static_cast<std::ptrdiff_t>(end));
+
+            // Start loading the next band while this one is read and
+            // written. Larger batches already stream through the whole file.
+            if (batchSize == 1 && end < bandsVec.size()) {
+                envi.prefetchBands({bandsVec[end]});
+            }
+
+            // Get bands from file
+            auto mats = envi.getBands(batch);
+
+            // Queue each band for writing. Stops if a writer failed.
+            bool open = true;
+            for (size_t i = 0; i < batch.size() && open; i++) {
+                auto id = envi.getWavelength(batch[i]);
+
+                // Complex bands are written as separate real and imaginary
+                // images
+                if (mats[i].channels() == 2) {
+                    std::vector<cv::Mat> parts;
+                    cv::split(mats[i], parts);
+                    mats[i].release();
+                    open = queue.push({id + "_real", std::move(parts[0])}) &&
+                           queue.push({id + "_imag", std::move(parts[1])});
+                } else {
+                    open = queue.push({id, std::move(mats[i])});
+                }
+            }
+            if (!open) {
+                break;
+            }
         }
+    } catch (...) {
+        queue.close();
+        for (auto& w : writers) {
+            w.join();
+        }
+        throw;
+    }
+
+    // Wait for the writers to finish
+    queue.close();
+    for (auto& w : writers) {
+        w.join();
     }
 
     // Make sure the file gets closed
     envi.closeFile();
+
+    if (writeError) {
+        std::rethrow_exception(writeError);
+    }
+
+    // Finish the stack
+    if (stack) {
+        stack->close();
+    }
+}
+
+// Write a band image to the output directory
+void WriteBand(
+    const fs::path& outputDir,
+    const std::string& id,
+    cv::Mat m,
+    unsigned threads)
+{
+    // Select file extension. Only 8-bit bands are written as PNG.
+    fs::path out = outputDir / (id + ".png");
+    auto depth = m.depth();
+    if (depth != CV_8U) {
+        out.replace_extension("tif");
+    }
+
+    // cv::imwrite() may convert other depths to 8-bit, so write them here
+    if (depth == CV_16S || depth == CV_32S || depth == CV_32F ||
+        depth == CV_64F) {
+        et::TIFFIO::WriteOptions opts;
+        opts.threads = threads;
+        et::TIFFIO::WriteTIFF(out, m, opts);
+    } else {
+        cv::imwrite(out.string(), m);
+    }
 }
 
 // Split a string (presumably comma separated) into a list of bands
@@ -0,0 +1,114 @@
+// Convert an ENVI file between the BSQ, BIL, and BIP interleaves
+//
+
+#include <algorithm>
+#include <iostream>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "envitools/ENVI.hpp"
+#include "envitools/ENVIWriter.hpp"
+
+namespace et = envitools;
+namespace fs = boost::filesystem;
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[])
+{
+    ///// Setup program options /////
+    // clang-format off
+    po::options_description options("Options");
+    options.add_options()
+        ("help,h","Show this message")
+        ("input-file,i", po::value<std::string>()->required(),
+            "Path to the input ENVI header file")
+        ("output-file,o", po::value<std::string>()->required(),
+            "Path to the output ENVI header file (e.g. cube.hdr)")
+        ("interleave,t", po::value<std::string>()->required(),
+            "Output interleave: bsq, bil, or bip")
+        ("max-memory,m", po::value<size_t>()->default_value(1024),
+            "Maximum memory (in MB) used to hold each block of lines");
+    // clang-format on
+
+    po::variables_map parsed;
+    po::store(
+        po::command_line_parser(argc, argv).options(options).run(), parsed);
+
+    // show the help message
+    if (parsed.count("help") || argc < 4) {
+        std::cout << options << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    // warn of missing options
+    try {
+        po::notify(parsed);
+    } catch (po::error& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ///// Get important paths /////
+    fs::path inputPath = parsed["input-file"].as<std::string>();
+    fs::path outputPath = parsed["output-file"].as<std::string>();
+    if (!fs::exists(inputPath)) {
+        std::cerr << "Error: File path does not exist." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ///// Output interleave /////
+    auto opt = parsed["interleave"].as<std::string>();
+    boost::to_lower(opt);
+    et::ENVI::Interleave interleave;
+    if (opt == "bsq") {
+        interleave = et::ENVI::Interleave::BandSequential;
+    } else if (opt == "bil") {
+        interleave = et::ENVI::Interleave::BandByLine;
+    } else if (opt == "bip") {
+        interleave = et::ENVI::Interleave::BandByPixel;
+    } else {
+        std::cerr << "Error: Unrecognized interleave: " << opt << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    ///// Load ENVI file /////
+    et::ENVI envi(inputPath);
+    envi.setAccessMode(et::ENVI::AccessMode::KeepOpen);
+
+    et::ENVIWriter writer(
+        outputPath, envi.width(), envi.height(), envi.bands(), envi.datatype(),
+        interleave);
+    writer.setWavelengths(envi.getWavelengths());
+
+    // Keep everything else, such as map info and band names
+    for (const auto& key : envi.getFieldNames()) {
+        if (!et::ENVIWriter::IsLayoutField(key)) {
+            writer.setField(
+                key, envi.getField(key), envi.isBracedField(key));
+        }
+    }
+
+    ///// Transcode /////
+    // Copy blocks of lines of every band. Each block is one tile read from the
+    // input and one tile write to the output, so the whole cube is converted
+    // in a single pass with bounded memory. Pixels are copied as stored, so
+    // every datatype is transcoded without conversion.
+    auto maxBytes = parsed["max-memory"].as<size_t>() << 20;
+    auto lineBytes = envi.elementSize() * static_cast<size_t>(envi.width()) *
+                     static_cast<size_t>(envi.bands());
+    auto blockLines = static_cast<int>(std::min<size_t>(
+        static_cast<size_t>(envi.height()),
+        std::max<size_t>(1, maxBytes / lineBytes)));
+
+    for (int y = 0; y < envi.height(); y += blockLines) {
+        auto end = std::min(y + blockLines, envi.height());
+        std::cerr << "Lines: " << end << "/" << envi.height() << "\r";
+        writer.writeLines(envi.getRawRegion({0, y, envi.width(), end}));
+    }
+    std::cerr << std::endl;
+
+    writer.close();
+    envi.closeFile();
+}
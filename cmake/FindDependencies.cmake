@@ -18,6 +18,9 @@ endif()
 ### LibTIFF ###
 find_package(TIFF REQUIRED)
 
+### Threads ###
+find_package(Threads REQUIRED)
+
 ############
 # Optional #
 ############
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include <opencv2/core.hpp>
+
+#include "envitools/Box.hpp"
+
+namespace envitools
+{
+
+/**
+  @class BandCache
+  @brief Size-bounded LRU cache of decoded band images
+
+  Stores band images read by ENVI so that repeated requests for the same band
+  and window do not go back to disk. The cache is bounded by the total number
+  of bytes held by its images. When a new image does not fit, the least
+  recently used images are evicted.
+
+  A single cache can be shared by any number of ENVI objects and threads.
+  Entries are keyed by data file path, so objects reading the same file share
+  cached bands.
+
+  @warning Images returned by get() share their pixel data with the cache.
+  Use cv::Mat::clone() before modifying them.
+
+  @ingroup envitools
+*/
+class BandCache
+{
+public:
+    /** @brief Cache key: data file path, band index, and read window */
+    struct Key {
+        /** Path to the ENVI data file */
+        std::string path;
+        /** Band index */
+        int band;
+        /** Spatial window which was read */
+        Box window;
+
+        /** @brief Strict weak ordering for use in ordered containers */
+        bool operator<(const Key& rhs) const
+        {
+            return std::tie(
+                       path, band, window.xmin, window.ymin, window.xmax,
+                       window.ymax) <
+                   std::tie(
+                       rhs.path, rhs.band, rhs.window.xmin, rhs.window.ymin,
+                       rhs.window.xmax, rhs.window.ymax);
+        }
+    };
+
+    /** @brief Shared pointer type */
+    using Pointer = std::shared_ptr<BandCache>;
+
+    /** @brief Construct a cache which holds at most capacity bytes */
+    explicit BandCache(size_t capacity) : capacity_{capacity} {}
+
+    /** @copybrief BandCache(size_t) */
+    static Pointer New(size_t capacity)
+    {
+        return std::make_shared<BandCache>(capacity);
+    }
+
+    /**
+     * @brief Look up an image in the cache
+     *
+     * Marks the image as the most recently used.
+     *
+     * @return True if the image was found and assigned to img
+     */
+    bool get(const Key& key, cv::Mat& img);
+
+    /**
+     * @brief Add an image to the cache
+     *
+     * Replaces any image already stored with the same key. Images larger
+     * than the capacity of the cache are not stored.
+     */
+    void put(const Key& key, const cv::Mat& img);
+
+    /** @brief Remove every image from the cache */
+    void clear();
+
+    /** @brief Get the number of bytes held by cached images */
+    size_t size();
+
+    /** @brief Get the maximum number of bytes the cache will hold */
+    size_t capacity() const { return capacity_; }
+
+private:
+    /** Cached image and its key, most recently used first */
+    using Entry = std::pair<Key, cv::Mat>;
+    using EntryList = std::list<Entry>;
+
+    /** Remove the entry at it */
+    void erase_(EntryList::iterator it);
+
+    /** Maximum number of bytes held by cached images */
+    size_t capacity_;
+    /** Number of bytes held by cached images */
+    size_t size_{0};
+    /** Cached entries in recency order */
+    EntryList entries_;
+    /** Entry lookup by key */
+    std::map<Key, EntryList::iterator> index_;
+    /** Guards all members */
+    std::mutex mutex_;
+};
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace envitools
+{
+
+/**
+  @class BoundedQueue
+  @brief Thread-safe FIFO queue with a fixed capacity
+
+  Producers block in push() while the queue is full and consumers block in
+  pop() while it is empty. This bounds the number of in-flight items in a
+  producer/consumer pipeline, and with it the pipeline's memory use.
+
+  Once close() is called, push() no longer accepts items and pop() returns
+  false after the remaining items have been drained.
+
+  @ingroup envitools
+*/
+template <typename T>
+class BoundedQueue
+{
+public:
+    /** @brief Construct a queue which holds at most capacity items */
+    explicit BoundedQueue(size_t capacity)
+        : capacity_{capacity > 0 ? capacity : 1}
+    {
+    }
+
+    /**
+     * @brief Add an item to the back of the queue
+     *
+     * Blocks while the queue is full.
+     *
+     * @return False if the queue was closed and the item was not added
+     */
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(
+            lock, [this]() { return closed_ || queue_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        queue_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Remove an item from the front of the queue
+     *
+     * Blocks while the queue is empty and open.
+     *
+     * @return False if the queue is closed and empty
+     */
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return false;
+        }
+        item = std::move(queue_.front());
+        queue_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    /** @brief Stop accepting items and wake all waiting threads */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+private:
+    /** Maximum number of queued items */
+    size_t capacity_;
+    /** Whether the queue has been closed */
+    bool closed_{false};
+    /** Queued items */
+    std::deque<T> queue_;
+    /** Guards all members */
+    std::mutex mutex_;
+    /** Signaled when an item is removed or the queue is closed */
+    std::condition_variable notFull_;
+    /** Signaled when an item is added or the queue is closed */
+    std::condition_variable notEmpty_;
+};
+}
@@ -0,0 +1,111 @@
+/**
+ * @file ByteOrder.hpp
+ * @brief Byte order detection and conversion utilities
+ *
+ * The swap kernels are written as simple loops over fixed-width integers so
+ * that the compiler can vectorize them into byte shuffles.
+ *
+ * @ingroup io
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <boost/predef/other/endian.h>
+
+namespace envitools
+{
+
+/** @brief Whether the host stores multi-byte values in big-endian order */
+constexpr bool HostIsBigEndian()
+{
+#if BOOST_ENDIAN_BIG_BYTE
+    return true;
+#else
+    return false;
+#endif
+}
+
+namespace detail
+{
+inline uint16_t Swap(uint16_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap16(v);
+#else
+    return static_cast<uint16_t>((v << 8) | (v >> 8));
+#endif
+}
+
+inline uint32_t Swap(uint32_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap32(v);
+#else
+    return ((v & 0x000000FFu) << 24) | ((v & 0x0000FF00u) << 8) |
+           ((v & 0x00FF0000u) >> 8) | ((v & 0xFF000000u) >> 24);
+#endif
+}
+
+inline uint64_t Swap(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(v);
+#else
+    return (static_cast<uint64_t>(Swap(static_cast<uint32_t>(v))) << 32) |
+           Swap(static_cast<uint32_t>(v >> 32));
+#endif
+}
+
+// Swap count words of type U stored at data. memcpy keeps this free of
+// aliasing problems and compiles down to plain loads and stores.
+template <typename U>
+inline void SwapWords(char* data, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        U v;
+        std::memcpy(&v, data + i * sizeof(U), sizeof(U));
+        v = Swap(v);
+        std::memcpy(data + i * sizeof(U), &v, sizeof(U));
+    }
+}
+}
+
+/**
+ * @brief Reverse the byte order of every word in a buffer, in place
+ *
+ * @param data Start of the buffer
+ * @param count Number of words in the buffer
+ * @param wordSize Size of each word in bytes. Must be 1, 2, 4, or 8.
+ */
+inline void ByteSwap(void* data, size_t count, size_t wordSize)
+{
+    auto bytes = static_cast<char*>(data);
+    switch (wordSize) {
+        case 1:
+            break;
+        case 2:
+            detail::SwapWords<uint16_t>(bytes, count);
+            break;
+        case 4:
+            detail::SwapWords<uint32_t>(bytes, count);
+            break;
+        case 8:
+            detail::SwapWords<uint64_t>(bytes, count);
+            break;
+        default:
+            throw std::invalid_argument(
+                "Unsupported word size: " + std::to_string(wordSize));
+    }
+}
+
+/** @brief Reverse the byte order of every element in a buffer, in place */
+template <typename T>
+inline void ByteSwap(T* data, size_t count)
+{
+    ByteSwap(data, count, sizeof(T));
+}
+}
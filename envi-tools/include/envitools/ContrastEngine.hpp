@@ -0,0 +1,112 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "envitools/Box.hpp"
+#include "envitools/ContrastMetrics.hpp"
+
+namespace envitools
+{
+
+/**
+  @class ContrastEngine
+  @brief Compute tone mapped contrast metrics from only the pixels they sample
+
+  Computes the same metrics as running ContrastMetrics::MichelsonContrast()
+  and ContrastMetrics::RMSContrast() on an image tone mapped with ToneMap().
+  Instead of tone mapping the whole image, the tone curve is applied to the
+  sampled pixels only. The sum and sum of squares of every region are
+  accumulated in a single pass over the rows which the regions cover, so
+  pixels shared by overlapping regions are only read and tone mapped once.
+  The only whole-image work is finding the image's range, which the tone
+  curve is normalized by. Michelson points are read with
+  ContrastMetrics::GatherMean() over linear indices sorted by their position
+  in memory. The indices are built for the size of the first image and reused
+  until an image of a different size is evaluated.
+
+  The point and region lists are fixed on construction and reused for every
+  image, so one engine can evaluate every wavelength of a cube.
+
+  @ingroup envitools
+*/
+class ContrastEngine
+{
+public:
+    /**
+     * @brief Prepare to compute contrast for a set of points and regions
+     *
+     * Michelson contrast is computed if either point list is not empty.
+     * Throws if a point or region has a negative coordinate.
+     *
+     * @param fgPts Foreground (e.g. ink) points for Michelson contrast, as
+     * (x, y)
+     * @param bgPts Background (e.g. papyrus) points for Michelson contrast,
+     * as (x, y)
+     * @param regions Regions for RMS contrast
+     * @param gamma Gamma of the tone curve, as in ToneMap()
+     */
+    ContrastEngine(
+        std::vector<cv::Vec2i> fgPts,
+        std::vector<cv::Vec2i> bgPts,
+        std::vector<Box> regions,
+        float gamma = 1.0f);
+
+    /** @brief Whether evaluate() computes Michelson contrast */
+    bool hasMichelson() const { return !fgPts_.empty() || !bgPts_.empty(); }
+
+    /** @brief Number of values returned by evaluate() */
+    size_t size() const { return (hasMichelson() ? 1 : 0) + regions_.size(); }
+
+    /**
+     * @brief Compute every metric for an image
+     *
+     * Throws if a point or region is outside of the image.
+     *
+     * @param image Single-channel, 32-bit floating point image
+     * @return The Michelson contrast, if hasMichelson(), followed by the RMS
+     * contrast of each region in the order they were given
+     */
+    std::vector<double> evaluate(const cv::Mat& image) const;
+
+private:
+    /** Rows covered by the same regions */
+    struct Segment {
+        /** First row */
+        int y0;
+        /** One past the last row */
+        int y1;
+        /** Disjoint column ranges [first, second) covered by the regions */
+        std::vector<std::pair<int, int>> spans;
+        /** Indices of the regions which cover these rows */
+        std::vector<size_t> regions;
+    };
+
+    /** Foreground points */
+    std::vector<cv::Vec2i> fgPts_;
+    /** Background points */
+    std::vector<cv::Vec2i> bgPts_;
+    /** RMS regions */
+    std::vector<Box> regions_;
+    /** Tone curve gamma */
+    float gamma_;
+
+    /** Sorted point indices for an image size, built if needed */
+    std::shared_ptr<const ContrastMetrics::MichelsonSampler> sampler_for_(
+        const cv::Size& size) const;
+    /** Sorted point indices for the last image size */
+    mutable std::shared_ptr<const ContrastMetrics::MichelsonSampler> sampler_;
+    /** Guards sampler_ */
+    mutable std::mutex samplerMutex_;
+
+    /** Regions split into runs of rows with the same coverage */
+    std::vector<Segment> segments_;
+    /** Minimum image size which contains every point and region */
+    int minCols_{0};
+    int minRows_{0};
+};
+}
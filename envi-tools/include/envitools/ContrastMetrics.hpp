@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <vector>
+
 #include <opencv2/core.hpp>
 
 #include "envitools/Box.hpp"
@@ -8,11 +11,175 @@ namespace envitools
 {
 namespace ContrastMetrics
 {
+/**
+ * @brief Michelson contrast of the mean foreground and background
+ *
+ * Uses the same sorted gather as MichelsonSampler. Supports single-channel
+ * 8-bit unsigned, 16-bit unsigned, 32-bit floating point, and 64-bit floating
+ * point images. Throws if a point is outside of the image.
+ *
+ * @param fgPts Foreground points, as (x, y)
+ * @param bgPts Background points, as (x, y)
+ */
 double MichelsonContrast(
     const cv::Mat& image,
     const std::vector<cv::Vec2i>& fgPts,
     const std::vector<cv::Vec2i>& bgPts);
 
 double RMSContrast(const cv::Mat& image, const Box& region);
+
+/**
+ * @brief Linear indices of points in an image, sorted by position in memory
+ *
+ * Index y * size.width + x for each point (x, y). Throws if a point is
+ * outside of the image size.
+ */
+std::vector<size_t> LinearIndex(
+    const std::vector<cv::Vec2i>& pts, const cv::Size& size);
+
+/**
+ * @brief Mean of f(pixel) over the pixels at a list of linear indices
+ *
+ * Indices should be sorted, as returned by LinearIndex(), so that the image
+ * is read in memory order. Indices are not bounds checked. For continuous
+ * images, four independent sums are accumulated so that the adds can
+ * overlap. Returns 0 if there are no indices.
+ *
+ * @tparam T Pixel type of the single-channel image
+ * @param f Applied to each pixel before summing, e.g. a tone curve
+ */
+template <typename T, typename F>
+double GatherMean(const cv::Mat& image, const std::vector<size_t>& index, F f)
+{
+    const auto n = index.size();
+    if (n == 0) {
+        return 0.0;
+    }
+
+    double s0 = 0.0;
+    double s1 = 0.0;
+    double s2 = 0.0;
+    double s3 = 0.0;
+
+    if (image.isContinuous()) {
+        const auto* data = image.ptr<T>();
+        const auto* idx = index.data();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            s0 += f(data[idx[i]]);
+            s1 += f(data[idx[i + 1]]);
+            s2 += f(data[idx[i + 2]]);
+            s3 += f(data[idx[i + 3]]);
+        }
+        for (; i < n; i++) {
+            s0 += f(data[idx[i]]);
+        }
+    } else {
+        // Rows aren't contiguous, so look up the row of each index
+        const auto cols = static_cast<size_t>(image.cols);
+        for (const auto& i : index) {
+            s0 += f(image.ptr<T>(static_cast<int>(i / cols))[i % cols]);
+        }
+    }
+
+    return (s0 + s1 + s2 + s3) / static_cast<double>(n);
+}
+
+/** @brief Mean of the pixels at a list of linear indices */
+template <typename T>
+double GatherMean(const cv::Mat& image, const std::vector<size_t>& index)
+{
+    return GatherMean<T>(image, index, [](T v) { return v; });
+}
+
+/**
+  @class MichelsonSampler
+  @brief Michelson contrast of a fixed set of points, for many images
+
+  Computes the same value as MichelsonContrast(), but the points are
+  converted once into linear pixel indices, sorted by their position in
+  memory. Each evaluation is then an unchecked gather over the sorted
+  indices, so large point sets can be evaluated cheaply for every band of
+  a cube.
+
+  Supports single-channel 8-bit unsigned, 16-bit unsigned, 32-bit floating
+  point, and 64-bit floating point images.
+*/
+class MichelsonSampler
+{
+public:
+    /**
+     * @brief Prepare to sample images of a given size
+     *
+     * Throws if a point is outside of the image size.
+     *
+     * @param fgPts Foreground points, as (x, y)
+     * @param bgPts Background points, as (x, y)
+     * @param imageSize Size of every image passed to evaluate()
+     */
+    MichelsonSampler(
+        const std::vector<cv::Vec2i>& fgPts,
+        const std::vector<cv::Vec2i>& bgPts,
+        const cv::Size& imageSize);
+
+    /**
+     * @brief Compute the Michelson contrast of an image
+     *
+     * Throws if the image doesn't match the sampler's size or has an
+     * unsupported type.
+     */
+    double evaluate(const cv::Mat& image) const;
+
+    /** @brief Size of the images which can be evaluated */
+    cv::Size imageSize() const { return size_; }
+
+    /** @brief Sorted linear indices of the foreground points */
+    const std::vector<size_t>& foreground() const { return fg_; }
+
+    /** @brief Sorted linear indices of the background points */
+    const std::vector<size_t>& background() const { return bg_; }
+
+private:
+    /** Image size */
+    cv::Size size_;
+    /** Sorted linear indices of the foreground points */
+    std::vector<size_t> fg_;
+    /** Sorted linear indices of the background points */
+    std::vector<size_t> bg_;
+};
+
+/**
+ * @brief RMS contrast of many regions of the same image
+ *
+ * Builds double precision sum and squared-sum integral images once, then
+ * computes each region's contrast in constant time. Faster than calling
+ * RMSContrast(const cv::Mat&, const Box&) for each region when there are
+ * many regions or they overlap. The image is shifted by its mean first,
+ * which keeps the variance accurate for large images.
+ *
+ * Throws if the image has more than one channel or a region is outside of
+ * the image. Empty regions have a contrast of 0.
+ *
+ * @return The contrast of each region, in order
+ */
+std::vector<double> RMSContrast(
+    const cv::Mat& image, const std::vector<Box>& regions);
+
+/**
+ * @brief Dense map of RMS contrast in a sliding window
+ *
+ * Element (r, c) of the map is the RMS contrast of the window whose top-left
+ * corner is at (c * stride, r * stride). Windows are only placed where they
+ * fit entirely within the image. Each window is computed in constant time
+ * from integral images, as in
+ * RMSContrast(const cv::Mat&, const std::vector<Box>&).
+ *
+ * @param image Single-channel image
+ * @param window Size of the window
+ * @param stride Distance between neighboring windows, in pixels
+ * @return CV_64FC1 map. Empty if the window is larger than the image.
+ */
+cv::Mat RMSContrastMap(
+    const cv::Mat& image, const cv::Size& window, int stride = 1);
 }
 }
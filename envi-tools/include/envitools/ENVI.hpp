@@ -1,14 +1,36 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <exception>
-#include <fstream>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <set>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <opencv2/core.hpp>
 
+#include "envitools/BandCache.hpp"
+#include "envitools/Box.hpp"
+#include "envitools/ByteOrder.hpp"
+
+namespace boost
+{
+namespace interprocess
+{
+class mapped_region;
+}
+}
+
 namespace envitools
 {
 
@@ -21,6 +43,11 @@ namespace envitools
 
   Reads ENVI files and streams band information from disk.
 
+  All data access functions may be called concurrently from multiple threads.
+  Reads use positional I/O, so threads never share a file position. Functions
+  which change the object's state, such as setAccessMode(), setCache(), and
+  closeFile(), must not be called while reads are in progress.
+
   More information at:
   <a href="https://www.harrisgeospatial.com/docs/ENVIHeaderFiles.html">ENVI
   Header Files</a>
@@ -31,7 +58,16 @@ namespace envitools
 class ENVI
 {
 public:
-    /** @brief Fundamental datatype options */
+    /**
+     * @brief Fundamental datatype options
+     *
+     * Images are returned with the OpenCV depth that matches the datatype.
+     * Complex32 and Complex64 are returned as two-channel CV_32F and CV_64F
+     * images, where channel 0 is the real part and channel 1 is the
+     * imaginary part. Unsigned32, Signed64, and Unsigned64 have no OpenCV
+     * depth and are returned as CV_64F. 64-bit integers with a magnitude
+     * larger than 2^53 lose precision.
+     */
     enum class DataType {
         Unsigned8 = 1,
         Signed16,
@@ -39,7 +75,7 @@ public:
         Float32,
         Float64,
         Complex32,
-        Complex64,
+        Complex64 = 9,
         Unsigned16 = 12,
         Unsigned32,
         Signed64,
@@ -87,11 +123,16 @@ public:
      * getBand().
      *
      * <b>CloseOnComplete (default)</b>: The data file stream will be
-     * immediately closed.
+     * closed once no reads are in progress.
      *
      * <b>KeepOpen</b>: The data file stream will remain open.
+     *
+     * <b>MemoryMapped</b>: The data file is memory mapped once and remains
+     * mapped until closeFile() is called. For band sequential files,
+     * getBand() returns an image which points directly into the mapping
+     * without copying any data.
      * */
-    enum class AccessMode { CloseOnComplete, KeepOpen };
+    enum class AccessMode { CloseOnComplete, KeepOpen, MemoryMapped };
 
     /** @brief Shared pointer type */
     using Pointer = std::shared_ptr<ENVI>;
@@ -113,6 +154,9 @@ public:
         parse_header_(header);
     }
 
+    /** @brief Close the data file */
+    ~ENVI() { closeFile(); }
+
     /** @copybrief explicit ENVI(const boost::filesystem::path& header) */
     static Pointer New(const boost::filesystem::path& header)
     {
@@ -130,9 +174,142 @@ public:
 
     /** @name Data Access */
     ///@{
-    /** @brief Read specific band from ENVI file */
+    /**
+     * @brief Read specific band from ENVI file
+     *
+     * @warning If using the MemoryMapped access mode, the returned image may
+     * reference the memory mapping directly. It is only valid until
+     * closeFile() is called or this object is destroyed. Use cv::Mat::clone()
+     * if the image must outlive the mapping. Writing to the image does not
+     * modify the data file.
+     */
     cv::Mat getBand(int b);
 
+    /**
+     * @brief Read specific band from ENVI file and convert it to a new depth
+     *
+     * Each pixel is converted to `value * scale + offset` and saturated to
+     * the output depth while the data is still in cache, one small block of
+     * rows at a time. This avoids reading the band at its native depth and
+     * then converting it with cv::Mat::convertTo() in a second pass.
+     *
+     * Converted bands are not added to the band cache. Complex datatypes
+     * cannot be converted.
+     *
+     * @param b ID number of band to extract
+     * @param depth Output depth: CV_8U, CV_16U, CV_16S, CV_32S, CV_32F, or
+     * CV_64F
+     * @param scale Multiplier applied to each pixel
+     * @param offset Value added to each pixel after scaling
+     */
+    cv::Mat getBand(int b, int depth, double scale = 1.0, double offset = 0.0);
+
+    /**
+     * @brief Read specific band from ENVI file on a background thread
+     *
+     * Returns immediately. The returned future holds the band, or the
+     * exception thrown while reading it. Lets a consumer work on one band
+     * while the next is being read. This object must outlive the future.
+     *
+     * @copydetails getBand(int)
+     */
+    std::future<cv::Mat> getBandAsync(int b);
+
+    /**
+     * @brief Hint that a list of bands will be read soon
+     *
+     * Asks the operating system to start loading the bytes of each band into
+     * the page cache in the background, with posix_fadvise() or, in the
+     * MemoryMapped access mode, madvise(). Returns without waiting for the
+     * data. A consumer iterating over bands can prefetch band N+1 before
+     * processing band N, so that disk reads overlap with computation. Does
+     * nothing on platforms without these hints.
+     *
+     * Adjacent blocks are hinted together. Since every band of a BIP file is
+     * spread over the whole file, only its first lines are hinted, up to
+     * about 64 MB. The rest is loaded by the operating system's sequential
+     * read-ahead once the band is read.
+     */
+    void prefetchBands(const std::vector<int>& bands);
+
+    /**
+     * @brief Read a list of bands from ENVI file
+     *
+     * For BIP and BIL files, the data file is read once from start to finish
+     * and every requested band is filled simultaneously. This is much faster
+     * than calling getBand() for each band, but every requested band must fit
+     * in memory at the same time.
+     *
+     * Bands are returned in the same order as they were requested.
+     *
+     * @copydetails getBand(int)
+     */
+    std::vector<cv::Mat> getBands(const std::vector<int>& bands);
+
+    /**
+     * @brief Read every band from ENVI file
+     *
+     * @copydetails getBands(const std::vector<int>&)
+     */
+    std::vector<cv::Mat> getBands();
+
+    /**
+     * @brief Read the spectrum of a single pixel from ENVI file
+     *
+     * Returns a 1 x bands() image with the file's native bit depth. For BIP
+     * files, the spectrum is a single contiguous read.
+     */
+    cv::Mat getSpectrum(int x, int y);
+
+    /**
+     * @brief Read the spectra of a list of pixels from ENVI file
+     *
+     * Returns a pts.size() x bands() image with the file's native bit depth.
+     * Row i is the spectrum of pts[i]. Points are given as (x, y), the same
+     * as the output of CSVIO::ReadPointCSV(). For BIP files, each spectrum is
+     * a single contiguous read, and points are read in file order. For BIL
+     * files, each line which contains a point is only read once.
+     */
+    cv::Mat getSpectra(const std::vector<cv::Vec2i>& pts);
+
+    /**
+     * @brief Read every spectrum in a line of the ENVI file
+     *
+     * Returns a bands() x width() image with the file's native bit depth. Row
+     * b is row y of band b. For BIL and BIP files, the line is a single
+     * contiguous read.
+     */
+    cv::Mat getSpectralLine(int y);
+
+    /**
+     * @brief Read a spatial window of a range of bands from ENVI file
+     *
+     * Only the bytes which cover the window are read from the data file.
+     * Like ContrastMetrics::RMSContrast(), the window covers the pixels in
+     * [roi.xmin, roi.xmax) x [roi.ymin, roi.ymax).
+     *
+     * @param roi Spatial window to read
+     * @param bands Range of band indices to read. Defaults to every band.
+     * @return One image per band with the file's native bit depth
+     */
+    std::vector<cv::Mat> getRegion(
+        const Box& roi, cv::Range bands = cv::Range::all());
+
+    /**
+     * @brief Read a spatial window of a range of bands without converting it
+     *
+     * Same as getRegion(), except that the pixels are returned as stored,
+     * in the host byte order. Unsigned32, Signed64, and Unsigned64 are not
+     * widened to CV_64F: their raw values are held in a same-sized image
+     * type (CV_32S for Unsigned32, CV_64F for the 64-bit integers). Useful
+     * for copying pixels to another file, such as with ENVIWriter. Raw
+     * regions are not cached.
+     *
+     * @copydetails getRegion()
+     */
+    std::vector<cv::Mat> getRawRegion(
+        const Box& roi, cv::Range bands = cv::Range::all());
+
     /** @brief Get wavelength of band as string */
     std::string getWavelength(int b) { return wavelengths_[b]; }
 
@@ -145,13 +322,41 @@ public:
      *  remain open after a call to getBand(). This can slightly improve
      *  performance when repeatedly accessing the data file.
      *
-     *  @warning If using the KeepOpen access mode, it's good practice to call
-     *  closeFile() when access to the data file is no longer needed.
+     *  If set to ENVI::AccessMode::MemoryMapped, the data file will be memory
+     *  mapped on the next call to getBand().
+     *
+     *  Changing the access mode closes the data file if it is open.
+     *
+     *  @warning If using the KeepOpen or MemoryMapped access modes, it's good
+     *  practice to call closeFile() when access to the data file is no longer
+     *  needed.
      */
-    void setAccessMode(AccessMode m) { accessMode_ = m; }
+    void setAccessMode(AccessMode m)
+    {
+        if (m != accessMode_) {
+            closeFile();
+        }
+        accessMode_ = m;
+    }
 
-    /** @brief Close the data file stream if it's open */
+    /** @brief Close the data file stream or mapping if it's open */
     void closeFile();
+
+    /**
+     * @brief Set the band cache
+     *
+     * When set, getBand(), getBands(), and getRegion() return cached images
+     * when possible and add the images they read to the cache. The same
+     * cache can be given to any number of ENVI objects. Pass nullptr to stop
+     * using a cache.
+     *
+     * @warning Images returned from the cache share their pixel data with
+     * it. Use cv::Mat::clone() before modifying them.
+     */
+    void setCache(BandCache::Pointer cache) { cache_ = std::move(cache); }
+
+    /** @brief Get the band cache */
+    BandCache::Pointer cache() const { return cache_; }
     ///@}
 
     /** @name Metadata */
@@ -168,6 +373,54 @@ public:
     int height() { return lines_; }
     /** @brief Get the number of band images */
     int bands() { return bands_; }
+    /** @brief Get the size in bytes of a single band element */
+    size_t elementSize();
+    /**
+     * @brief Get the number of whole bands which fit in a memory budget
+     *
+     * Always at least 1. Useful for sizing the batches of bands passed to
+     * getBands(), where every band of a batch is held in memory at once.
+     */
+    size_t bandsPerBatch(size_t maxBytes);
+    /** @brief Get the number of bytes before the image data in the data file
+     */
+    uint64_t headerOffset() { return headerOffset_; }
+    /** @brief Whether the header defines a data ignore value */
+    bool hasDataIgnoreValue() { return hasIgnoreValue_; }
+    /** @brief Get the value used to mark bad or missing pixels */
+    double dataIgnoreValue() { return ignoreValue_; }
+
+    /** @brief Whether the header contains a field
+     *
+     * Field names are case-insensitive.
+     */
+    bool hasField(const std::string& key);
+
+    /** @brief Get the raw value of a header field
+     *
+     * For brace-enclosed values, returns the text between the braces. Field
+     * names are case-insensitive. Throws std::out_of_range if the field is not
+     * in the header.
+     */
+    std::string getField(const std::string& key);
+
+    /** @brief Get the comma-separated list value of a header field
+     *
+     * Useful for fields like "map info" and "band names". Each item is
+     * trimmed of whitespace.
+     */
+    std::vector<std::string> getFieldList(const std::string& key);
+
+    /** @brief Whether a header field's value was enclosed in braces
+     *
+     * List fields such as "band names", and multi-line fields such as
+     * "description", must be braced even when they hold a single item.
+     * Field names are case-insensitive.
+     */
+    bool isBracedField(const std::string& key);
+
+    /** @brief Get the lowercase name of every header field */
+    std::vector<std::string> getFieldNames();
     ///@}
 
     /** @name Debug */
@@ -191,14 +444,14 @@ private:
      * file
      *
      * Position is dependent upon ENVI::Interleave and ENVI::DataType of the
-     * ENVI file
+     * ENVI file, and includes the header offset
      */
     uint64_t pos_of_elem_(uint64_t band, uint64_t y, uint64_t x, uint64_t size);
 
     /** ENVI file's fundamental datatype */
     DataType type_{DataType::Float32};
     /** ENVI file's endianess */
-    Endianness endian_{Endianness::Big};
+    Endianness endian_{Endianness::Little};
     /** ENVI file's band ordering */
     Interleave interleave_{Interleave::BandSequential};
     /** Number of samples for each band (aka image width) */
@@ -207,22 +460,242 @@ private:
     int lines_{0};
     /** Number of bands in ENVI file */
     int bands_{0};
+    /** Number of bytes before the image data in the data file */
+    uint64_t headerOffset_{0};
 
     /** Path to ENVI data file */
     boost::filesystem::path dataPath_;
 
-    /** File stream for repeated access */
-    std::ifstream ifs_;
+    /** File descriptor for positional reads */
+    int fd_{-1};
+    /** Guards opening and closing the data file */
+    std::mutex fileMutex_;
+    /** Number of reads in progress */
+    int readers_{0};
+
+    /** Memory mapping of the data file */
+    std::shared_ptr<boost::interprocess::mapped_region> mapping_;
+    /** Start of the mapped data file */
+    char* mapData_{nullptr};
+    /** Size of the mapped data file in bytes */
+    uint64_t mapSize_{0};
 
-    /** Open the filestream if it's not already open */
+    /** Open the file descriptor or mapping if it's not already open */
     void open_file_();
 
+    /**
+     * @brief Keeps the data file open for the lifetime of a read
+     *
+     * Opens the data file if needed on construction. On destruction, closes
+     * it if this was the last read in progress and the access mode is
+     * ENVI::AccessMode::CloseOnComplete.
+     */
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(ENVI& envi) : envi_(envi) { envi_.begin_read_(); }
+        ~ReadGuard() { envi_.finish_read_(); }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+    private:
+        ENVI& envi_;
+    };
+
+    /** Open the data file and register a read in progress */
+    void begin_read_();
+
+    /**
+     * @brief Read a block of bytes starting at a position in the data file
+     *
+     * Uses positional reads, so concurrent calls do not interfere with each
+     * other. Throws if the full block could not be read.
+     */
+    void read_bytes_(uint64_t pos, char* dst, size_t length);
+
+    /** Hint that a block of bytes in the data file will be read soon */
+    void advise_range_(uint64_t pos, uint64_t length);
+
+    /** Hint a list of (position, length) blocks, merging adjacent blocks */
+    void advise_ranges_(std::vector<std::pair<uint64_t, uint64_t>> ranges);
+
+    /** Bytes at the start of a BIP file hinted by prefetchBands() */
+    static constexpr uint64_t PrefetchWindow = 64 * 1024 * 1024;
+
+    /** Throw if b is not a valid band index */
+    void check_band_(int b);
+
+    /** Throw if (x, y) is not a valid pixel position */
+    void check_pixel_(int x, int y);
+
+    /** Throw if roi is empty or not inside of the band images */
+    void check_region_(const Box& roi);
+
+    /** Expand cv::Range::all() to every band and throw if out of range */
+    cv::Range check_band_range_(cv::Range bands);
+
+    /** Shared band cache */
+    BandCache::Pointer cache_;
+
+    /** Build the cache key for a band and window of this file */
+    BandCache::Key cache_key_(int b, const Box& window);
+
+    /** Add an image to the cache, if there is one */
+    void cache_put_(const BandCache::Key& key, const cv::Mat& img);
+
+    /** Unregister a read and close the data file if required */
+    void finish_read_();
+
+    /**
+     * @brief Call f with a value of the storage type of the ENVI file
+     *
+     * Lets a generic lambda instantiate a reader for the file's datatype
+     * without repeating the datatype switch, so every reader gets a
+     * specialized inner loop per datatype. The storage type always has the
+     * same size as the file's datatype. Types without a matching OpenCV
+     * depth are read into a same-sized storage type, and must be passed
+     * through to_output_type_() afterwards.
+     */
+    template <typename Func>
+    auto dispatch_type_(Func&& f) -> decltype(f(uint8_t{}))
+    {
+        switch (type_) {
+            case DataType::Unsigned8:
+                return f(uint8_t{});
+            case DataType::Signed16:
+                return f(int16_t{});
+            case DataType::Signed32:
+                return f(int32_t{});
+            case DataType::Float32:
+                return f(float{});
+            case DataType::Float64:
+                return f(double{});
+            case DataType::Complex32:
+                return f(cv::Vec2f{});
+            case DataType::Complex64:
+                return f(cv::Vec2d{});
+            case DataType::Unsigned16:
+                return f(uint16_t{});
+            case DataType::Unsigned32:
+                return f(int32_t{});
+            case DataType::Signed64:
+            case DataType::Unsigned64:
+                return f(double{});
+        }
+        throw std::runtime_error("Unknown ENVI data type");
+    }
+
+    /**
+     * @brief Convert images from their storage type to their output type
+     *
+     * Unsigned32, Signed64, and Unsigned64 have no OpenCV depth. They are
+     * read as raw bits into a storage type of the same size and converted to
+     * CV_64F here. Does nothing for other datatypes.
+     */
+    void to_output_type_(cv::Mat& img);
+
+    /** @copydoc to_output_type_(cv::Mat&) */
+    void to_output_type_(std::vector<cv::Mat>& imgs)
+    {
+        for (auto& m : imgs) {
+            to_output_type_(m);
+        }
+    }
+
+    /**
+     * @brief Call f with a value of the true C++ type of the ENVI file
+     *
+     * Unlike dispatch_type_(), every datatype is passed as its real type,
+     * including those without an OpenCV depth. Throws for complex types.
+     */
+    template <typename Func>
+    auto dispatch_file_type_(Func&& f) -> decltype(f(uint8_t{}))
+    {
+        switch (type_) {
+            case DataType::Unsigned8:
+                return f(uint8_t{});
+            case DataType::Signed16:
+                return f(int16_t{});
+            case DataType::Signed32:
+                return f(int32_t{});
+            case DataType::Float32:
+                return f(float{});
+            case DataType::Float64:
+                return f(double{});
+            case DataType::Unsigned16:
+                return f(uint16_t{});
+            case DataType::Unsigned32:
+                return f(uint32_t{});
+            case DataType::Signed64:
+                return f(int64_t{});
+            case DataType::Unsigned64:
+                return f(uint64_t{});
+            case DataType::Complex32:
+            case DataType::Complex64:
+                throw std::runtime_error("Complex bands cannot be converted");
+        }
+        throw std::runtime_error("Unknown ENVI data type");
+    }
+
+    /** @brief Call f with a value of the C++ type of an OpenCV depth */
+    template <typename Func>
+    static auto dispatch_depth_(int depth, Func&& f) -> decltype(f(uint8_t{}))
+    {
+        switch (depth) {
+            case CV_8U:
+                return f(uint8_t{});
+            case CV_16U:
+                return f(uint16_t{});
+            case CV_16S:
+                return f(int16_t{});
+            case CV_32S:
+                return f(int32_t{});
+            case CV_32F:
+                return f(float{});
+            case CV_64F:
+                return f(double{});
+            default:
+                throw std::invalid_argument(
+                    "Unsupported output depth: " + std::to_string(depth));
+        }
+    }
+
+    /** Convert count elements of type T to the host byte order */
+    template <typename T>
+    static void swap_bytes_(T* data, size_t count)
+    {
+        // Multi-channel types (complex) swap each channel separately
+        constexpr auto cn = static_cast<size_t>(cv::DataType<T>::channels);
+        ByteSwap(data, count * cn, sizeof(T) / cn);
+    }
+
+    /** Whether the data file's byte order differs from the host's */
+    bool needs_byte_swap_() const
+    {
+        return (endian_ == Endianness::Big) != HostIsBigEndian();
+    }
+
+    /** Close the descriptor and mapping */
+    void close_file_();
+
+    /** Throw if a block of bytes is not inside of the mapped data file */
+    void check_mapped_range_(uint64_t pos, size_t length);
+
     /** Current data access mode */
     AccessMode accessMode_{AccessMode::CloseOnComplete};
 
     /** List of parsed wavelengths */
     std::vector<std::string> wavelengths_;
 
+    /** Whether the header defines a data ignore value */
+    bool hasIgnoreValue_{false};
+    /** Value used to mark bad or missing pixels */
+    double ignoreValue_{0};
+    /** Every header field, keyed by lowercase field name */
+    std::map<std::string, std::string> fields_;
+    /** Lowercase names of the fields whose values were enclosed in braces */
+    std::set<std::string> bracedFields_;
+
     /**
      * @brief Read a specific band image from the ENVI data file
      *
@@ -235,41 +708,513 @@ private:
     template <typename T>
     cv::Mat get_band_(int b)
     {
-        // Open the filestream
-        open_file_();
+        // Size of each element
+        auto length = sizeof(T);
+        auto band = static_cast<uint64_t>(b);
+        auto rowBytes = static_cast<size_t>(samples_) * length;
+
+        // Whether the file's byte order differs from the host's
+        auto swap = length > 1 && needs_byte_swap_();
+
+        // Mapped native-order BSQ bands can be returned without copying, as
+        // long as the header offset leaves them aligned
+        auto pos = pos_of_elem_(band, 0, 0, length);
+        if (mapData_ != nullptr && !swap &&
+            interleave_ == Interleave::BandSequential &&
+            reinterpret_cast<uintptr_t>(mapData_ + pos) % alignof(T) == 0) {
+            check_mapped_range_(pos, rowBytes * static_cast<size_t>(lines_));
+            return cv::Mat_<T>(
+                lines_, samples_, reinterpret_cast<T*>(mapData_ + pos));
+        }
 
         // Setup output Mat
         cv::Mat_<T> output(lines_, samples_);
 
-        // Size of each element
+        switch (interleave_) {
+            // Band is one contiguous block
+            case Interleave::BandSequential:
+                read_bytes_(
+                    pos, reinterpret_cast<char*>(output.data),
+                    rowBytes * static_cast<size_t>(lines_));
+                break;
+            // Each row of the band is contiguous
+            case Interleave::BandByLine:
+                for (int y = 0; y < lines_; y++) {
+                    read_bytes_(
+                        pos_of_elem_(band, static_cast<uint64_t>(y), 0, length),
+                        reinterpret_cast<char*>(output.template ptr<T>(y)),
+                        rowBytes);
+                }
+                break;
+            // Read a full line of every band and de-interleave in memory
+            case Interleave::BandByPixel: {
+                auto stride = static_cast<size_t>(bands_);
+                std::vector<T> buffer(static_cast<size_t>(samples_) * stride);
+                for (int y = 0; y < lines_; y++) {
+                    read_bytes_(
+                        pos_of_elem_(0, static_cast<uint64_t>(y), 0, length),
+                        reinterpret_cast<char*>(buffer.data()),
+                        buffer.size() * length);
+
+                    auto* row = output.template ptr<T>(y);
+                    const auto* src = buffer.data() + b;
+                    for (int x = 0; x < samples_; x++, src += stride) {
+                        row[x] = *src;
+                    }
+                }
+                break;
+            }
+        }
+
+        // Convert to the host byte order in one pass over the whole band
+        if (swap) {
+            swap_bytes_(
+                output.template ptr<T>(0),
+                static_cast<size_t>(lines_) * static_cast<size_t>(samples_));
+        }
+
+        return output;
+    }
+
+    /**
+     * @brief Read a list of band images from the ENVI data file
+     *
+     * For BIP and BIL files, the data file is streamed once in chunks of whole
+     * lines, and each chunk is scattered into every requested band.
+     *
+     * @tparam T Fundamental type of pixel data
+     * @param bands ID numbers of bands to extract
+     * @return Band images with pixel type T
+     */
+    template <typename T>
+    std::vector<cv::Mat> get_bands_(const std::vector<int>& bands)
+    {
+        std::vector<cv::Mat> output;
+        output.reserve(bands.size());
+
+        // Bands are already contiguous
+        if (interleave_ == Interleave::BandSequential) {
+            for (const auto& b : bands) {
+                output.push_back(get_band_<T>(b));
+            }
+            return output;
+        }
+
+        // Setup output Mats
+        std::vector<cv::Mat_<T>> mats;
+        mats.reserve(bands.size());
+        for (size_t i = 0; i < bands.size(); i++) {
+            mats.emplace_back(lines_, samples_);
+        }
+
+        // Size of each element and of a line of every band
         auto length = sizeof(T);
+        auto rowBytes = static_cast<size_t>(samples_) * length;
+        auto lineElems =
+            static_cast<size_t>(samples_) * static_cast<size_t>(bands_);
+
+        // Read as many lines as fit in the chunk buffer at once
+        constexpr size_t chunkBytes = 32 * 1024 * 1024;
+        auto linesPerChunk = std::max<size_t>(
+            1, std::min<size_t>(
+                   static_cast<size_t>(lines_),
+                   chunkBytes / (lineElems * length)));
+        std::vector<T> buffer(linesPerChunk * lineElems);
+        std::vector<T*> rows(bands.size());
 
-        // Loop over every pixel in that band
-        T value;
-        std::ifstream::streampos pos;
-        for (int y = 0; y < lines_; y++) {
-            for (int x = 0; x < samples_; x++) {
-                // Seek to the correct position in the data file
-                pos = pos_of_elem_(
-                    static_cast<uint64_t>(b), static_cast<uint64_t>(y),
-                    static_cast<uint64_t>(x), length);
-                ifs_.seekg(pos);
-
-                // Read the bytes
-                ifs_.read(reinterpret_cast<char*>(&value), length);
-                if (ifs_.fail()) {
-                    auto msg = "Only read " + std::to_string(ifs_.gcount()) +
-                               " bytes. Expected: " + std::to_string(length);
-                    throw std::runtime_error(msg);
+        for (int y0 = 0; y0 < lines_; y0 += static_cast<int>(linesPerChunk)) {
+            auto count = std::min<size_t>(
+                linesPerChunk, static_cast<size_t>(lines_ - y0));
+            read_bytes_(
+                pos_of_elem_(0, static_cast<uint64_t>(y0), 0, length),
+                reinterpret_cast<char*>(buffer.data()),
+                count * lineElems * length);
+
+            // Scatter each line into the band images
+            for (size_t i = 0; i < count; i++) {
+                auto y = y0 + static_cast<int>(i);
+                const auto* line = buffer.data() + i * lineElems;
+                for (size_t k = 0; k < bands.size(); k++) {
+                    rows[k] = mats[k].template ptr<T>(y);
                 }
 
-                // Assign to the mat
-                output.template at<T>(y, x) = value;
+                if (interleave_ == Interleave::BandByLine) {
+                    for (size_t k = 0; k < bands.size(); k++) {
+                        std::memcpy(
+                            rows[k], line + bands[k] * samples_, rowBytes);
+                    }
+                } else {
+                    for (int x = 0; x < samples_; x++) {
+                        const auto* px = line + x * bands_;
+                        for (size_t k = 0; k < bands.size(); k++) {
+                            rows[k][x] = px[bands[k]];
+                        }
+                    }
+                }
             }
         }
 
-        if (accessMode_ == AccessMode::CloseOnComplete) {
-            closeFile();
+        // Convert to the host byte order
+        for (auto& m : mats) {
+            if (length > 1 && needs_byte_swap_()) {
+                swap_bytes_(m.template ptr<T>(0), m.total());
+            }
+            output.push_back(m);
+        }
+
+        return output;
+    }
+
+    /**
+     * @brief Read the spectrum of a pixel from the ENVI data file
+     *
+     * @tparam T Fundamental type of pixel data
+     * @return 1 x bands_ image with pixel type T
+     */
+    template <typename T>
+    cv::Mat get_spectrum_(int x, int y)
+    {
+        // Setup output Mat
+        cv::Mat_<T> output(1, bands_);
+        auto* dst = output.template ptr<T>(0);
+
+        auto length = sizeof(T);
+        auto ux = static_cast<uint64_t>(x);
+        auto uy = static_cast<uint64_t>(y);
+
+        // Spectrum is contiguous
+        if (interleave_ == Interleave::BandByPixel) {
+            read_bytes_(
+                pos_of_elem_(0, uy, ux, length), reinterpret_cast<char*>(dst),
+                static_cast<size_t>(bands_) * length);
+        }
+
+        // One element per band
+        else {
+            for (int b = 0; b < bands_; b++) {
+                read_bytes_(
+                    pos_of_elem_(static_cast<uint64_t>(b), uy, ux, length),
+                    reinterpret_cast<char*>(dst + b), length);
+            }
+        }
+
+        if (length > 1 && needs_byte_swap_()) {
+            swap_bytes_(dst, static_cast<size_t>(bands_));
+        }
+
+        return output;
+    }
+
+    /**
+     * @brief Read a line of spectra from the ENVI data file
+     *
+     * @tparam T Fundamental type of pixel data
+     * @return bands_ x samples_ image with pixel type T
+     */
+    template <typename T>
+    cv::Mat get_spectral_line_(int y)
+    {
+        // Setup output Mat
+        cv::Mat_<T> output(bands_, samples_);
+
+        auto length = sizeof(T);
+        auto uy = static_cast<uint64_t>(y);
+        auto rowBytes = static_cast<size_t>(samples_) * length;
+        auto lineElems =
+            static_cast<size_t>(samples_) * static_cast<size_t>(bands_);
+
+        switch (interleave_) {
+            // Line is already laid out as bands x samples
+            case Interleave::BandByLine:
+                read_bytes_(
+                    pos_of_elem_(0, uy, 0, length),
+                    reinterpret_cast<char*>(output.template ptr<T>(0)),
+                    lineElems * length);
+                break;
+            // Line is samples x bands. Read once and transpose.
+            case Interleave::BandByPixel: {
+                std::vector<T> buffer(lineElems);
+                read_bytes_(
+                    pos_of_elem_(0, uy, 0, length),
+                    reinterpret_cast<char*>(buffer.data()),
+                    lineElems * length);
+                for (int b = 0; b < bands_; b++) {
+                    auto* row = output.template ptr<T>(b);
+                    const auto* src = buffer.data() + b;
+                    for (int x = 0; x < samples_; x++, src += bands_) {
+                        row[x] = *src;
+                    }
+                }
+                break;
+            }
+            // One row per band
+            case Interleave::BandSequential:
+                for (int b = 0; b < bands_; b++) {
+                    read_bytes_(
+                        pos_of_elem_(static_cast<uint64_t>(b), uy, 0, length),
+                        reinterpret_cast<char*>(output.template ptr<T>(b)),
+                        rowBytes);
+                }
+                break;
+        }
+
+        if (length > 1 && needs_byte_swap_()) {
+            swap_bytes_(output.template ptr<T>(0), lineElems);
+        }
+
+        return output;
+    }
+
+    /**
+     * @brief Read the spectra of a list of pixels from the ENVI data file
+     *
+     * @tparam T Fundamental type of pixel data
+     * @return pts.size() x bands_ image with pixel type T
+     */
+    template <typename T>
+    cv::Mat get_spectra_(const std::vector<cv::Vec2i>& pts)
+    {
+        cv::Mat_<T> output(static_cast<int>(pts.size()), bands_);
+
+        // Single pixel reads are already minimal for BSQ
+        if (interleave_ == Interleave::BandSequential) {
+            for (size_t i = 0; i < pts.size(); i++) {
+                get_spectrum_<T>(pts[i][0], pts[i][1])
+                    .copyTo(output.row(static_cast<int>(i)));
+            }
+            return output;
+        }
+
+        // Each BIP spectrum is one contiguous read. Visit the points in file
+        // order and read straight into the output.
+        if (interleave_ == Interleave::BandByPixel) {
+            std::vector<size_t> order(pts.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&pts](size_t a, size_t b) {
+                return std::make_pair(pts[a][1], pts[a][0]) <
+                       std::make_pair(pts[b][1], pts[b][0]);
+            });
+
+            auto length = sizeof(T);
+            for (const auto& i : order) {
+                read_bytes_(
+                    pos_of_elem_(
+                        0, static_cast<uint64_t>(pts[i][1]),
+                        static_cast<uint64_t>(pts[i][0]), length),
+                    reinterpret_cast<char*>(
+                        output.template ptr<T>(static_cast<int>(i))),
+                    static_cast<size_t>(bands_) * length);
+            }
+
+            if (length > 1 && needs_byte_swap_() && !pts.empty()) {
+                swap_bytes_(output.template ptr<T>(0), output.total());
+            }
+            return output;
+        }
+
+        // BIL: visit the points in line order so that each line is read once
+        std::vector<size_t> order(pts.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(
+            order.begin(), order.end(),
+            [&pts](size_t a, size_t b) { return pts[a][1] < pts[b][1]; });
+
+        cv::Mat_<T> line;
+        int lineY = -1;
+        for (const auto& i : order) {
+            auto x = pts[i][0];
+            auto y = pts[i][1];
+            if (y != lineY) {
+                line = get_spectral_line_<T>(y);
+                lineY = y;
+            }
+
+            auto* dst = output.template ptr<T>(static_cast<int>(i));
+            for (int b = 0; b < bands_; b++) {
+                dst[b] = line.template at<T>(b, x);
+            }
+        }
+
+        return output;
+    }
+
+    /**
+     * @brief Read a spatial window of a range of bands from the ENVI data file
+     *
+     * @tparam T Fundamental type of pixel data
+     * @param roi Spatial window to read
+     * @param bands Range of bands to read
+     * @return One image per band with pixel type T
+     */
+    template <typename T>
+    std::vector<cv::Mat> get_region_(const Box& roi, const cv::Range& bands)
+    {
+        // Setup output Mats
+        const auto w = roi.xmax - roi.xmin;
+        const auto h = roi.ymax - roi.ymin;
+        std::vector<cv::Mat_<T>> mats;
+        for (int b = bands.start; b < bands.end; b++) {
+            mats.emplace_back(h, w);
+        }
+
+        auto length = sizeof(T);
+        auto rowBytes = static_cast<size_t>(w) * length;
+        auto ux = static_cast<uint64_t>(roi.xmin);
+
+        // BIP windows are one contiguous run of pixels per line
+        std::vector<T> buffer;
+        if (interleave_ == Interleave::BandByPixel) {
+            buffer.resize(static_cast<size_t>(w) * static_cast<size_t>(bands_));
+        }
+
+        // Full-width BSQ windows are one contiguous block per band
+        if (interleave_ == Interleave::BandSequential && w == samples_) {
+            auto uy = static_cast<uint64_t>(roi.ymin);
+            for (size_t i = 0; i < mats.size(); i++) {
+                auto b = static_cast<uint64_t>(bands.start) + i;
+                read_bytes_(
+                    pos_of_elem_(b, uy, 0, length),
+                    reinterpret_cast<char*>(mats[i].template ptr<T>(0)),
+                    mats[i].total() * length);
+            }
+        }
+
+        // Otherwise, read line by line
+        else {
+            for (int y = 0; y < h; y++) {
+                auto uy = static_cast<uint64_t>(roi.ymin + y);
+
+                // One read per band per line
+                if (interleave_ != Interleave::BandByPixel) {
+                    for (size_t i = 0; i < mats.size(); i++) {
+                        auto b = static_cast<uint64_t>(bands.start) + i;
+                        auto* dst = mats[i].template ptr<T>(y);
+                        read_bytes_(
+                            pos_of_elem_(b, uy, ux, length),
+                            reinterpret_cast<char*>(dst), rowBytes);
+                    }
+                    continue;
+                }
+
+                // One read per line, then de-interleave
+                read_bytes_(
+                    pos_of_elem_(0, uy, ux, length),
+                    reinterpret_cast<char*>(buffer.data()),
+                    buffer.size() * length);
+                for (size_t i = 0; i < mats.size(); i++) {
+                    auto* row = mats[i].template ptr<T>(y);
+                    const auto* src = buffer.data() + bands.start + i;
+                    for (int x = 0; x < w; x++, src += bands_) {
+                        row[x] = *src;
+                    }
+                }
+            }
+        }
+
+        // Convert to the host byte order
+        std::vector<cv::Mat> output;
+        for (auto& m : mats) {
+            if (length > 1 && needs_byte_swap_()) {
+                swap_bytes_(m.template ptr<T>(0), m.total());
+            }
+            output.push_back(m);
+        }
+
+        return output;
+    }
+
+    /**
+     * @brief Read a band and convert it to a new type in a single pass
+     *
+     * Rows are read into a staging buffer small enough to stay in cache,
+     * converted to the host byte order, then scaled into the output image.
+     * Arithmetic is done in float when that is exact enough, so that the
+     * conversion loop vectorizes well.
+     *
+     * @tparam T Type of pixel data in the file
+     * @tparam O Type of pixel data in the output image
+     */
+    template <typename T, typename O>
+    cv::Mat get_band_as_(int b, double scale, double offset)
+    {
+        using Work = typename std::conditional<
+            std::is_same<O, float>::value &&
+                (sizeof(T) <= 2 || std::is_same<T, float>::value),
+            float, double>::type;
+
+        cv::Mat_<O> output(lines_, samples_);
+
+        auto length = sizeof(T);
+        auto band = static_cast<uint64_t>(b);
+        auto samples = static_cast<size_t>(samples_);
+        auto rowBytes = samples * length;
+        auto swap = length > 1 && needs_byte_swap_();
+        auto s = static_cast<Work>(scale);
+        auto o = static_cast<Work>(offset);
+
+        // Number of rows converted per block
+        constexpr size_t blockBytes = 256 * 1024;
+        auto blockRows = std::max<size_t>(
+            1, std::min<size_t>(
+                   static_cast<size_t>(lines_), blockBytes / rowBytes));
+        if (interleave_ == Interleave::BandByPixel) {
+            blockRows = 1;
+        }
+
+        std::vector<T> staging(blockRows * samples);
+        std::vector<T> line;
+        if (interleave_ == Interleave::BandByPixel) {
+            line.resize(samples * static_cast<size_t>(bands_));
+        }
+
+        for (int y0 = 0; y0 < lines_; y0 += static_cast<int>(blockRows)) {
+            auto count =
+                std::min<size_t>(blockRows, static_cast<size_t>(lines_ - y0));
+            auto uy = static_cast<uint64_t>(y0);
+
+            // Gather the native values for this block
+            switch (interleave_) {
+                case Interleave::BandSequential:
+                    read_bytes_(
+                        pos_of_elem_(band, uy, 0, length),
+                        reinterpret_cast<char*>(staging.data()),
+                        count * rowBytes);
+                    break;
+                case Interleave::BandByLine:
+                    for (size_t i = 0; i < count; i++) {
+                        read_bytes_(
+                            pos_of_elem_(band, uy + i, 0, length),
+                            reinterpret_cast<char*>(
+                                staging.data() + i * samples),
+                            rowBytes);
+                    }
+                    break;
+                case Interleave::BandByPixel: {
+                    read_bytes_(
+                        pos_of_elem_(0, uy, 0, length),
+                        reinterpret_cast<char*>(line.data()),
+                        line.size() * length);
+                    const auto* src = line.data() + b;
+                    for (size_t x = 0; x < samples; x++, src += bands_) {
+                        staging[x] = *src;
+                    }
+                    break;
+                }
+            }
+
+            if (swap) {
+                ByteSwap(staging.data(), count * samples);
+            }
+
+            // Scale into the output
+            for (size_t i = 0; i < count; i++) {
+                const auto* src = staging.data() + i * samples;
+                auto* dst = output.template ptr<O>(y0 + static_cast<int>(i));
+                for (size_t x = 0; x < samples; x++) {
+                    dst[x] = cv::saturate_cast<O>(
+                        static_cast<Work>(src[x]) * s + o);
+                }
+            }
         }
 
         return output;
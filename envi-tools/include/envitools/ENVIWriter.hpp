@@ -0,0 +1,206 @@
+#pragma once
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <opencv2/core.hpp>
+
+#include "envitools/ENVI.hpp"
+
+namespace envitools
+{
+
+/**
+  @class ENVIWriter
+  @brief Streaming ENVI file writer
+
+  Writes an ENVI data file incrementally, so that cubes of any size can be
+  written with constant memory. Band sequential files are written one band at
+  a time with writeBand(). Band interleaved files are written one line at a
+  time with writeLine(). Any file can also be written in blocks of lines of
+  every band with writeLines(). Data is always written in the host byte
+  order.
+
+  Images must have the OpenCV type of the file's datatype, as listed in
+  ENVI::DataType. Unsigned32, Signed64, and Unsigned64 have no OpenCV depth.
+  Their images hold the raw values in a type of the same size, CV_32S for
+  Unsigned32 and CV_64F for the 64-bit integers, as returned by
+  ENVI::getRawRegion().
+
+  The header is written by close(), which is also called on destruction.
+
+  @ingroup envitools
+  @ingroup io
+*/
+class ENVIWriter
+{
+public:
+    /** @brief Shared pointer type */
+    using Pointer = std::shared_ptr<ENVIWriter>;
+
+    /**
+     * @brief Open a new ENVI file for writing
+     *
+     * The data file is written next to the header with the header's
+     * extension removed, which is where ENVI looks for it.
+     *
+     * @param header Path to the output header file (e.g. "cube.hdr")
+     * @param width Number of samples in each line
+     * @param height Number of lines in each band
+     * @param bands Number of bands
+     * @param type Datatype of the data file
+     * @param interleave Layout of the data file
+     */
+    ENVIWriter(
+        boost::filesystem::path header,
+        int width,
+        int height,
+        int bands,
+        ENVI::DataType type,
+        ENVI::Interleave interleave = ENVI::Interleave::BandSequential);
+
+    /** @copybrief ENVIWriter */
+    static Pointer New(
+        boost::filesystem::path header,
+        int width,
+        int height,
+        int bands,
+        ENVI::DataType type,
+        ENVI::Interleave interleave = ENVI::Interleave::BandSequential)
+    {
+        return std::make_shared<ENVIWriter>(
+            std::move(header), width, height, bands, type, interleave);
+    }
+
+    /** @brief Close the file, ignoring errors */
+    ~ENVIWriter();
+
+    ENVIWriter(const ENVIWriter&) = delete;
+    ENVIWriter& operator=(const ENVIWriter&) = delete;
+
+    /** @brief Set the wavelength of each band, written to the header */
+    void setWavelengths(std::vector<std::string> w)
+    {
+        wavelengths_ = std::move(w);
+    }
+
+    /**
+     * @brief Set an extra header field, such as "map info" or "band names"
+     *
+     * The value is written as given, in the form returned by
+     * ENVI::getField(). It is enclosed in braces if braced is true, or if it
+     * contains a comma or a newline. Layout fields are written by the writer
+     * itself and throw std::invalid_argument.
+     *
+     * @param braced Enclose the value in braces, as required for lists such
+     * as "band names" even when they hold one item. Use
+     * ENVI::isBracedField() to keep the form of a copied field.
+     * @see IsLayoutField()
+     */
+    void setField(
+        const std::string& key, std::string value, bool braced = false);
+
+    /**
+     * @brief Whether a header field is written from the writer's own state
+     *
+     * True for the fields which describe the data file's layout (e.g.
+     * "samples", "interleave", "byte order") and for "wavelength". Field
+     * names are case-insensitive.
+     */
+    static bool IsLayoutField(const std::string& key);
+
+    /**
+     * @brief Append the next band to a band sequential file
+     *
+     * @param band width x height image whose depth matches the datatype
+     */
+    void writeBand(const cv::Mat& band);
+
+    /**
+     * @brief Append the next line to a band interleaved file
+     *
+     * @param line bands x width image whose depth matches the datatype. Row b
+     * is the line of band b, the same layout returned by
+     * ENVI::getSpectralLine().
+     */
+    void writeLine(const cv::Mat& line);
+
+    /**
+     * @brief Append the next block of lines of every band
+     *
+     * Works with every interleave, so a cube can be transcoded by reading
+     * and writing blocks of lines of every band (e.g. with
+     * ENVI::getRawRegion()). For BSQ files, the rows of each band are written
+     * at that band's offset in the data file. Cannot be mixed with
+     * writeBand().
+     *
+     * @param bands One image per band, each with the same number of rows and
+     * width columns
+     */
+    void writeLines(const std::vector<cv::Mat>& bands);
+
+    /**
+     * @brief Flush the data file and write the header
+     *
+     * Throws if fewer bands or lines were written than the file's
+     * dimensions require. Does nothing if already closed.
+     */
+    void close();
+
+    /** @brief Get the path to the data file */
+    boost::filesystem::path dataPath() const { return dataPath_; }
+
+private:
+    /** Throw if img's type doesn't match the file's datatype */
+    void check_type_(const cv::Mat& img);
+
+    /** Write one line of a BIL or BIP file given the row of each band */
+    void write_line_(const std::vector<const uchar*>& rows, size_t elemSize);
+
+    /** Write the header file */
+    void write_header_();
+
+    /** Write a block of bytes to the data file */
+    void write_bytes_(const char* data, size_t length);
+
+    /** Path to header file */
+    boost::filesystem::path headerPath_;
+    /** Path to data file */
+    boost::filesystem::path dataPath_;
+    /** Data file stream */
+    std::ofstream ofs_;
+    /** Data file stream buffer, so small writes are combined */
+    std::vector<char> streamBuffer_;
+    /** Scratch buffer for de-interleaving lines */
+    std::vector<char> lineBuffer_;
+
+    /** Number of samples in each line */
+    int samples_;
+    /** Number of lines in each band */
+    int lines_;
+    /** Number of bands */
+    int bands_;
+    /** Datatype of the data file */
+    ENVI::DataType type_;
+    /** Layout of the data file */
+    ENVI::Interleave interleave_;
+    /** Wavelength of each band */
+    std::vector<std::string> wavelengths_;
+    /** Extra header fields */
+    std::map<std::string, std::string> fields_;
+    /** Names of the extra header fields which are enclosed in braces */
+    std::set<std::string> bracedFields_;
+
+    /** Number of bands or lines written so far */
+    int written_{0};
+    /** Whether a BSQ file is being written by lines */
+    bool byLines_{false};
+    /** Whether close() has completed */
+    bool closed_{false};
+};
+}
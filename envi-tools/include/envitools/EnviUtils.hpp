@@ -9,7 +9,7 @@ namespace envitools
 {
 
 // given path to image (wavelength).tif, return wavelength
-static std::string ParseWavelength(boost::filesystem::path imagePath)
+inline std::string ParseWavelength(boost::filesystem::path imagePath)
 {
     auto name = imagePath.stem().string();
 
@@ -21,7 +21,7 @@ static std::string ParseWavelength(boost::filesystem::path imagePath)
     return name;
 }
 
-static cv::Mat ToneMap(const cv::Mat& m, float gamma = 1.0f)
+inline cv::Mat ToneMap(const cv::Mat& m, float gamma = 1.0f)
 {
     // Make a working copy
     auto tmp = m.clone();
@@ -45,7 +45,7 @@ static cv::Mat ToneMap(const cv::Mat& m, float gamma = 1.0f)
 
 // return the filenames of all files that have the specified extension
 // in the specified directory and all subdirectories
-static std::vector<boost::filesystem::path> FindByExtension(
+inline std::vector<boost::filesystem::path> FindByExtension(
     const boost::filesystem::path root, const std::string ext)
 {
     std::vector<boost::filesystem::path> ret;
@@ -69,7 +69,7 @@ static std::vector<boost::filesystem::path> FindByExtension(
     return ret;
 }
 
-static int RandomInt(int a, int b)
+inline int RandomInt(int a, int b)
 {
     std::random_device genDevice;
     std::uniform_int_distribution<int> genDist(a, b);
@@ -9,20 +9,183 @@
 
 #pragma once
 
+#include <memory>
+#include <string>
+
 #include <boost/filesystem.hpp>
 #include <opencv2/core.hpp>
 
+#include "envitools/Box.hpp"
+
 namespace envitools
 {
 namespace TIFFIO
 {
+/** @brief Compression schemes supported by WriteTIFF() */
+enum class Compression { None, LZW, Deflate, ZSTD };
+
+/** @brief Encoding options for WriteTIFF() */
+struct WriteOptions {
+    /**
+     * @brief Compression scheme
+     *
+     * ZSTD requires libtiff 4.0.10 or later built with ZSTD support.
+     */
+    Compression compression{Compression::LZW};
+
+    /**
+     * @brief Compression level
+     *
+     * 1-9 for Deflate and 1-22 for ZSTD. Higher levels give smaller files but
+     * are slower. If 0, the codec's default level is used. Ignored by the
+     * other schemes.
+     */
+    int level{0};
+
+    /**
+     * @brief Apply a predictor before compressing
+     *
+     * Uses horizontal differencing for integer images and the floating point
+     * predictor for floating point images. Usually makes smooth images much
+     * smaller. Ignored without compression.
+     */
+    bool predictor{false};
+
+    /**
+     * @brief Write the image as square tiles instead of strips
+     *
+     * Lets readers decode small regions of large images without
+     * decompressing whole rows.
+     */
+    bool tiled{false};
+
+    /** @brief Tile width and height in pixels. Must be a multiple of 16. */
+    int tileSize{256};
+
+    /**
+     * @brief Number of rows in each strip
+     *
+     * If 0, strips of about 256 KB (uncompressed) are written. Ignored when
+     * writing tiles.
+     */
+    int rowsPerStrip{0};
+
+    /**
+     * @brief Number of threads used to compress strips or tiles
+     *
+     * Blocks are compressed in parallel, then written to the file in order.
+     * If 0, one thread per hardware thread is used. Compression is only
+     * parallel for images with more than one strip or tile.
+     */
+    unsigned threads{0};
+};
+
 /**
  * @brief Write a TIFF image to file
  *
- * Supports writing floating point TIFFs, in addition to 8 & 16 bit integral
- * types. Currently only supports single and three-channel images. Unless you
- * need to write a floating point image, using cv::imwrite() is a better option.
+ * Supports writing 8 & 16 bit integral, 32 bit signed integral, and
+ * floating point TIFFs. Currently only supports single and three-channel
+ * images. Unless you need to write a 32 bit integral or floating point image,
+ * using cv::imwrite() is a better option.
+ *
+ * @param path Output path. Must end in ".tif" or ".tiff".
+ * @param img Image to write
+ * @param opts Layout and compression of the file. By default, the image is
+ * LZW compressed in strips.
+ */
+void WriteTIFF(
+    const boost::filesystem::path& path,
+    const cv::Mat& img,
+    const WriteOptions& opts = WriteOptions());
+
+/**
+ * @class StackWriter
+ * @brief Write images as the pages of one multi-page TIFF
+ *
+ * Pages are appended one at a time, so a stack of any number of pages is
+ * written with constant memory. Each page is encoded like WriteTIFF(), marked
+ * as a page of a multi-page document, and can store a description (e.g. the
+ * band's wavelength) in its ImageDescription tag. Use the page argument of
+ * ReadTIFF() to read a page.
+ *
+ * By default, the stack is written as a BigTIFF so that it is not limited to
+ * 4 GB.
+ *
+ * @ingroup io
+ */
+class StackWriter
+{
+public:
+    /**
+     * @brief Create a new multi-page TIFF
+     *
+     * @param path Output path. Must end in ".tif" or ".tiff".
+     * @param opts Layout and compression of every page
+     * @param bigTIFF Write a BigTIFF instead of a classic TIFF
+     */
+    explicit StackWriter(
+        const boost::filesystem::path& path,
+        WriteOptions opts = WriteOptions(),
+        bool bigTIFF = true);
+
+    /** @brief Close the file, reporting errors to std::cerr */
+    ~StackWriter();
+
+    StackWriter(const StackWriter&) = delete;
+    StackWriter& operator=(const StackWriter&) = delete;
+
+    /**
+     * @brief Append an image to the stack as the next page
+     *
+     * @param img Image to write. Supports the same images as WriteTIFF().
+     * @param description Stored in the page's ImageDescription tag if not
+     * empty
+     */
+    void writePage(const cv::Mat& img, const std::string& description = "");
+
+    /** @brief Number of pages written so far */
+    size_t pages() const { return pages_; }
+
+    /** @brief Flush and close the file. Does nothing if already closed. */
+    void close();
+
+private:
+    /** Open libtiff file */
+    struct Handle;
+    std::unique_ptr<Handle> handle_;
+    /** Encoding options for each page */
+    WriteOptions opts_;
+    /** Number of pages written */
+    size_t pages_{0};
+};
+
+/**
+ * @brief Read a TIFF image from file
+ *
+ * Supports 8 & 16 bit integral, 32 bit signed integral, and floating point
+ * samples with one to four channels, in strips or tiles, with any compression
+ * supported by libtiff. Like cv::imread(), three and four-channel RGB images
+ * are returned in BGR order. Unlike cv::imread(), floating point images are
+ * always returned at their native depth.
+ *
+ * @param path Path to the TIFF file
+ * @param page Index of the page to read from a multi-page TIFF
+ */
+cv::Mat ReadTIFF(const boost::filesystem::path& path, int page = 0);
+
+/**
+ * @brief Read a window of a TIFF image from file
+ *
+ * Only the strips or tiles which intersect the window are decoded, so small
+ * windows of large images are cheap to read, especially from tiled files.
+ * Like ContrastMetrics::RMSContrast(), the window covers the pixels in
+ * [region.xmin, region.xmax) x [region.ymin, region.ymax). Throws if the
+ * window is empty or not inside of the image.
+ *
+ * @copydetails ReadTIFF()
+ * @param region Window to read
  */
-void WriteTIFF(const boost::filesystem::path& path, const cv::Mat& img);
+cv::Mat ReadTIFFRegion(
+    const boost::filesystem::path& path, const Box& region, int page = 0);
 }
 }
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include "envitools/BandCache.hpp"
+
+using namespace envitools;
+
+// Size of an image's pixel data
+static size_t ImageBytes(const cv::Mat& img)
+{
+    return img.total() * img.elemSize();
+}
+
+// Find an image and move it to the front of the list
+bool BandCache::get(const Key& key, cv::Mat& img)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return false;
+    }
+
+    entries_.splice(entries_.begin(), entries_, it->second);
+    img = it->second->second;
+    return true;
+}
+
+// Add an image, evicting the least recently used images to make room
+void BandCache::put(const Key& key, const cv::Mat& img)
+{
+    auto bytes = ImageBytes(img);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        erase_(it->second);
+    }
+
+    if (bytes > capacity_) {
+        return;
+    }
+
+    while (size_ + bytes > capacity_ && !entries_.empty()) {
+        erase_(std::prev(entries_.end()));
+    }
+
+    entries_.emplace_front(key, img);
+    index_[key] = entries_.begin();
+    size_ += bytes;
+}
+
+// Remove everything
+void BandCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_.clear();
+    index_.clear();
+    size_ = 0;
+}
+
+// Bytes currently held
+size_t BandCache::size()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+}
+
+// Remove a single entry. Caller must hold the lock.
+void BandCache::erase_(EntryList::iterator it)
+{
+    size_ -= ImageBytes(it->second);
+    index_.erase(it->first);
+    entries_.erase(it);
+}
@@ -0,0 +1,205 @@
+#include "envitools/ContrastEngine.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+using namespace envitools;
+
+namespace
+{
+// Pointwise form of ToneMap(): normalize by the image's range, then apply
+// the gamma curve. Like cv::Tonemap, flat images aren't normalized.
+class ToneCurve
+{
+public:
+    ToneCurve(double min, double max, float gamma)
+        : normalize_{max - min > DBL_EPSILON}
+        , min_{min}
+        , scale_{normalize_ ? 1.0 / (max - min) : 1.0}
+        , invGamma_{1.0f / gamma}
+    {
+    }
+
+    float operator()(float v) const
+    {
+        if (normalize_) {
+            v = static_cast<float>((v - min_) * scale_);
+        }
+        return std::pow(v, invGamma_);
+    }
+
+private:
+    bool normalize_;
+    double min_;
+    double scale_;
+    float invGamma_;
+};
+}
+
+// Throw if a coordinate is negative
+static void CheckCoordinate(int v, const std::string& what)
+{
+    if (v < 0) {
+        throw std::out_of_range(what + " has a negative coordinate");
+    }
+}
+
+ContrastEngine::ContrastEngine(
+    std::vector<cv::Vec2i> fgPts,
+    std::vector<cv::Vec2i> bgPts,
+    std::vector<Box> regions,
+    float gamma)
+    : fgPts_{std::move(fgPts)}
+    , bgPts_{std::move(bgPts)}
+    , regions_{std::move(regions)}
+    , gamma_{gamma}
+{
+    // Size of image needed for every sample
+    for (const auto* pts : {&fgPts_, &bgPts_}) {
+        for (const auto& pt : *pts) {
+            CheckCoordinate(pt[0], "Point");
+            CheckCoordinate(pt[1], "Point");
+            minCols_ = std::max(minCols_, pt[0] + 1);
+            minRows_ = std::max(minRows_, pt[1] + 1);
+        }
+    }
+    for (const auto& r : regions_) {
+        CheckCoordinate(r.xmin, "Region");
+        CheckCoordinate(r.ymin, "Region");
+        minCols_ = std::max(minCols_, r.xmax);
+        minRows_ = std::max(minRows_, r.ymax);
+    }
+
+    // Rows where the set of regions covering a row changes
+    std::vector<int> edges;
+    for (const auto& r : regions_) {
+        if (r.xmin < r.xmax && r.ymin < r.ymax) {
+            edges.push_back(r.ymin);
+            edges.push_back(r.ymax);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    // Split the rows at every edge
+    for (size_t e = 0; e + 1 < edges.size(); e++) {
+        Segment seg{edges[e], edges[e + 1], {}, {}};
+        for (size_t i = 0; i < regions_.size(); i++) {
+            const auto& r = regions_[i];
+            if (r.xmin < r.xmax && r.ymin <= seg.y0 && r.ymax >= seg.y1) {
+                seg.regions.push_back(i);
+                seg.spans.emplace_back(r.xmin, r.xmax);
+            }
+        }
+        if (seg.regions.empty()) {
+            continue;
+        }
+
+        // Merge overlapping column ranges
+        std::sort(seg.spans.begin(), seg.spans.end());
+        std::vector<std::pair<int, int>> merged{seg.spans.front()};
+        for (const auto& s : seg.spans) {
+            auto& last = merged.back();
+            if (s.first <= last.second) {
+                last.second = std::max(last.second, s.second);
+            } else {
+                merged.push_back(s);
+            }
+        }
+        seg.spans = std::move(merged);
+        segments_.push_back(std::move(seg));
+    }
+}
+
+std::vector<double> ContrastEngine::evaluate(const cv::Mat& image) const
+{
+    if (image.type() != CV_32FC1) {
+        throw std::invalid_argument(
+            "Contrast requires a single-channel, floating point image");
+    }
+    if (image.cols < minCols_ || image.rows < minRows_) {
+        throw std::out_of_range(
+            "Points or regions outside of image: need at least " +
+            std::to_string(minCols_) + "x" + std::to_string(minRows_));
+    }
+
+    // The tone curve needs the range of the whole image
+    double min{0};
+    double max{0};
+    cv::minMaxLoc(image, &min, &max);
+    ToneCurve tone(min, max, gamma_);
+
+    std::vector<double> results;
+    results.reserve(size());
+
+    // Michelson contrast of the mean foreground and background, gathered in
+    // memory order
+    if (hasMichelson()) {
+        auto sampler = sampler_for_(image.size());
+        auto fgAvg = ContrastMetrics::GatherMean<float>(
+            image, sampler->foreground(), tone);
+        auto bgAvg = ContrastMetrics::GatherMean<float>(
+            image, sampler->background(), tone);
+        results.push_back(std::abs((fgAvg - bgAvg) / (fgAvg + bgAvg)));
+    }
+
+    // Accumulate every region in one pass over the rows they cover
+    std::vector<double> sums(regions_.size(), 0.0);
+    std::vector<double> sumSqs(regions_.size(), 0.0);
+    std::vector<float> toned(static_cast<size_t>(image.cols));
+    for (const auto& seg : segments_) {
+        for (auto y = seg.y0; y < seg.y1; y++) {
+            // Tone map each covered pixel once
+            const auto* row = image.ptr<float>(y);
+            for (const auto& span : seg.spans) {
+                for (auto x = span.first; x < span.second; x++) {
+                    toned[static_cast<size_t>(x)] = tone(row[x]);
+                }
+            }
+
+            for (const auto& i : seg.regions) {
+                const auto& r = regions_[i];
+                double sum = 0.0;
+                double sumSq = 0.0;
+                for (auto x = r.xmin; x < r.xmax; x++) {
+                    double v = toned[static_cast<size_t>(x)];
+                    sum += v;
+                    sumSq += v * v;
+                }
+                sums[i] += sum;
+                sumSqs[i] += sumSq;
+            }
+        }
+    }
+
+    // Population standard deviation, the same as cv::meanStdDev()
+    for (size_t i = 0; i < regions_.size(); i++) {
+        const auto& r = regions_[i];
+        auto area = static_cast<double>(std::max(0, r.xmax - r.xmin)) *
+                    static_cast<double>(std::max(0, r.ymax - r.ymin));
+        if (area == 0.0) {
+            results.push_back(0.0);
+            continue;
+        }
+        auto mean = sums[i] / area;
+        auto variance = std::max(0.0, sumSqs[i] / area - mean * mean);
+        results.push_back(std::sqrt(variance));
+    }
+
+    return results;
+}
+
+// Images of a cube share a size, so the indices are only built once
+std::shared_ptr<const ContrastMetrics::MichelsonSampler>
+ContrastEngine::sampler_for_(const cv::Size& size) const
+{
+    std::lock_guard<std::mutex> lock(samplerMutex_);
+    if (!sampler_ || sampler_->imageSize() != size) {
+        sampler_ = std::make_shared<ContrastMetrics::MichelsonSampler>(
+            fgPts_, bgPts_, size);
+    }
+    return sampler_;
+}
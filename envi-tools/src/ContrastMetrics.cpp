@@ -1,5 +1,12 @@
 #include "envitools/ContrastMetrics.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+#include <opencv2/imgproc.hpp>
+
 using namespace envitools;
 
 double ContrastMetrics::MichelsonContrast(
@@ -7,22 +14,7 @@ double ContrastMetrics::MichelsonContrast(
     const std::vector<cv::Vec2i>& fgPts,
     const std::vector<cv::Vec2i>& bgPts)
 {
-    // Foreground average
-    double fgAvg = 0.0;
-    double sizeReciprocal = 1.0 / fgPts.size();
-    for (auto pt : fgPts) {
-        fgAvg += image.at<float>(pt[1], pt[0]) * sizeReciprocal;
-    }
-
-    // Background average
-    double bgAvg = 0.0;
-    sizeReciprocal = 1.0 / bgPts.size();
-    for (auto pt : bgPts) {
-        bgAvg += image.at<float>(pt[1], pt[0]) * sizeReciprocal;
-    }
-
-    // Contrast
-    return std::abs((fgAvg - bgAvg) / (fgAvg + bgAvg));
+    return MichelsonSampler(fgPts, bgPts, image.size()).evaluate(image);
 }
 
 double ContrastMetrics::RMSContrast(const cv::Mat& image, const Box& region)
@@ -35,3 +27,162 @@ double ContrastMetrics::RMSContrast(const cv::Mat& image, const Box& region)
 
     return stdDev[0];
 }
+
+namespace
+{
+// Sum and squared-sum integral images of an image shifted by its mean
+class Integrals
+{
+public:
+    explicit Integrals(const cv::Mat& image)
+    {
+        if (image.channels() != 1) {
+            throw std::invalid_argument(
+                "RMS contrast requires a single-channel image");
+        }
+
+        // Variance doesn't change with a shift. Centering the values keeps
+        // the squared sums small, so little precision is lost when they're
+        // subtracted.
+        cv::Mat centered;
+        image.convertTo(centered, CV_64F, 1.0, -cv::mean(image)[0]);
+        cv::integral(centered, sum_, sqSum_, CV_64F, CV_64F);
+    }
+
+    // Population standard deviation of [x0, x1) x [y0, y1)
+    double stdDev(int x0, int y0, int x1, int y1) const
+    {
+        auto area = static_cast<double>(x1 - x0) * (y1 - y0);
+        auto mean = boxSum(sum_, x0, y0, x1, y1) / area;
+        auto sqMean = boxSum(sqSum_, x0, y0, x1, y1) / area;
+        return std::sqrt(std::max(0.0, sqMean - mean * mean));
+    }
+
+private:
+    static double boxSum(const cv::Mat& m, int x0, int y0, int x1, int y1)
+    {
+        return m.at<double>(y1, x1) - m.at<double>(y0, x1) -
+               m.at<double>(y1, x0) + m.at<double>(y0, x0);
+    }
+
+    cv::Mat sum_;
+    cv::Mat sqSum_;
+};
+}
+
+std::vector<double> ContrastMetrics::RMSContrast(
+    const cv::Mat& image, const std::vector<Box>& regions)
+{
+    for (const auto& r : regions) {
+        if (r.xmin < 0 || r.ymin < 0 || r.xmax > image.cols ||
+            r.ymax > image.rows) {
+            throw std::out_of_range("Region outside of image");
+        }
+    }
+
+    Integrals integrals(image);
+    std::vector<double> results;
+    results.reserve(regions.size());
+    for (const auto& r : regions) {
+        if (r.xmin >= r.xmax || r.ymin >= r.ymax) {
+            results.push_back(0.0);
+        } else {
+            results.push_back(
+                integrals.stdDev(r.xmin, r.ymin, r.xmax, r.ymax));
+        }
+    }
+    return results;
+}
+
+cv::Mat ContrastMetrics::RMSContrastMap(
+    const cv::Mat& image, const cv::Size& window, int stride)
+{
+    if (window.width < 1 || window.height < 1 || stride < 1) {
+        throw std::invalid_argument("Window size and stride must be positive");
+    }
+    if (window.width > image.cols || window.height > image.rows) {
+        return cv::Mat();
+    }
+
+    Integrals integrals(image);
+    auto rows = (image.rows - window.height) / stride + 1;
+    auto cols = (image.cols - window.width) / stride + 1;
+    cv::Mat_<double> map(rows, cols);
+    for (auto r = 0; r < rows; r++) {
+        auto y = r * stride;
+        auto* out = map[r];
+        for (auto c = 0; c < cols; c++) {
+            auto x = c * stride;
+            out[c] = integrals.stdDev(
+                x, y, x + window.width, y + window.height);
+        }
+    }
+    return map;
+}
+
+std::vector<size_t> ContrastMetrics::LinearIndex(
+    const std::vector<cv::Vec2i>& pts, const cv::Size& size)
+{
+    std::vector<size_t> index;
+    index.reserve(pts.size());
+    for (const auto& pt : pts) {
+        if (pt[0] < 0 || pt[1] < 0 || pt[0] >= size.width ||
+            pt[1] >= size.height) {
+            throw std::out_of_range("Point outside of image");
+        }
+        index.push_back(
+            static_cast<size_t>(pt[1]) * static_cast<size_t>(size.width) +
+            static_cast<size_t>(pt[0]));
+    }
+    std::sort(index.begin(), index.end());
+    return index;
+}
+
+namespace
+{
+template <typename T>
+double Michelson(
+    const cv::Mat& image,
+    const std::vector<size_t>& fg,
+    const std::vector<size_t>& bg)
+{
+    auto fgAvg = ContrastMetrics::GatherMean<T>(image, fg);
+    auto bgAvg = ContrastMetrics::GatherMean<T>(image, bg);
+    return std::abs((fgAvg - bgAvg) / (fgAvg + bgAvg));
+}
+}
+
+ContrastMetrics::MichelsonSampler::MichelsonSampler(
+    const std::vector<cv::Vec2i>& fgPts,
+    const std::vector<cv::Vec2i>& bgPts,
+    const cv::Size& imageSize)
+    : size_{imageSize}
+    , fg_{LinearIndex(fgPts, imageSize)}
+    , bg_{LinearIndex(bgPts, imageSize)}
+{
+}
+
+double ContrastMetrics::MichelsonSampler::evaluate(const cv::Mat& image) const
+{
+    if (image.size() != size_) {
+        throw std::invalid_argument("Image size doesn't match the sampler");
+    }
+    if (image.channels() != 1) {
+        throw std::invalid_argument(
+            "Michelson contrast requires a single-channel image");
+    }
+
+    switch (image.depth()) {
+        case CV_8U:
+            return Michelson<uint8_t>(image, fg_, bg_);
+        case CV_16U:
+            return Michelson<uint16_t>(image, fg_, bg_);
+        case CV_32F:
+            return Michelson<float>(image, fg_, bg_);
+        case CV_64F:
+            return Michelson<double>(image, fg_, bg_);
+        default:
+            throw std::invalid_argument(
+                "Unsupported image depth for Michelson contrast");
+    }
+}
@@ -1,108 +1,230 @@
 #include "envitools/ENVI.hpp"
 
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <cstring>
 #include <exception>
-#include <regex>
+#include <fstream>
+#include <iterator>
+#include <numeric>
 
-#include <boost/algorithm/string.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
 using namespace envitools;
 
 using ExtList = std::array<std::string, 2>;
 static const ExtList DataExts{"", "raw"};
 
-// Read an ENVI header file
+// Header parsing helpers
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Trimmed copy of [begin, end)
+static std::string Trimmed(const char* begin, const char* end)
+{
+    while (begin < end && IsSpace(*begin)) {
+        begin++;
+    }
+    while (end > begin && IsSpace(*(end - 1))) {
+        end--;
+    }
+    return {begin, end};
+}
+
+static std::string Lowered(std::string s)
+{
+    for (auto& c : s) {
+        if (c >= 'A' && c <= 'Z') {
+            c = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+    return s;
+}
+
+// Split a brace list value on commas
+static std::vector<std::string> SplitList(const std::string& value)
+{
+    std::vector<std::string> output;
+    const auto* begin = value.data();
+    const auto* end = begin + value.size();
+    while (begin < end) {
+        const auto* comma = std::find(begin, end, ',');
+        auto item = Trimmed(begin, comma);
+        if (!item.empty()) {
+            output.push_back(std::move(item));
+        }
+        begin = comma == end ? end : comma + 1;
+    }
+    return output;
+}
+
+// Integer value of a header field
+template <typename T>
+static T ParseInt(const std::string& key, const std::string& value)
+{
+    try {
+        size_t used = 0;
+        auto result = std::stoll(value, &used);
+        if (Trimmed(value.data() + used, value.data() + value.size()) != "") {
+            throw std::invalid_argument(value);
+        }
+        return static_cast<T>(result);
+    } catch (const std::logic_error&) {
+        throw std::runtime_error(
+            "Invalid value for header field \"" + key + "\": " + value);
+    }
+}
+
+// Read an ENVI header file. Every "key = value" line is stored in fields_.
+// Values starting with '{' continue until the matching '}', even across
+// lines.
 void ENVI::parse_header_(const fs::path& header)
 {
-    // Open file
-    std::ifstream ifs(header.string());
+    // Read the whole file at once
+    std::ifstream ifs(header.string(), std::ios::binary);
     if (!ifs.good()) {
         throw std::runtime_error("Cannot open header");
     }
+    std::string buf{
+        std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+    ifs.close();
 
-    // Lines we know how to handle
-    std::regex envi{"^ENVI"};
-    std::regex type{"^data type"};
-    std::regex endian{"^byte order"};
-    std::regex interleave("^interleave");
-    std::regex samples("^samples");
-    std::regex lines("^lines");
-    std::regex bands("^bands");
-    std::regex bandIDs("^wavelength", std::regex::icase);
-
-    // Start parsing
-    std::string line;
+    const auto* pos = buf.data();
+    const auto* end = pos + buf.size();
 
     // Check first line says ENVI
-    std::getline(ifs, line);
-    boost::trim(line);
-    if (!std::regex_match(line, envi)) {
+    const auto* eol = std::find(pos, end, '\n');
+    if (Trimmed(pos, eol) != "ENVI") {
         throw std::runtime_error("File is not an ENVI header file");
     }
+    pos = eol;
 
-    // Begin parsing loop
-    std::vector<std::string> strs;
-    while (std::getline(ifs, line)) {
-        // Split the line by =
-        boost::trim(line);
-        boost::split(strs, line, boost::is_any_of("="));
-        std::for_each(std::begin(strs), std::end(strs), [](std::string& t) {
-            boost::trim(t);
-        });
+    // Tokenize the remaining lines
+    while (pos < end) {
+        // Skip the newline
+        pos++;
+        eol = std::find(pos, end, '\n');
+        const auto* eq = std::find(pos, eol, '=');
 
-        // Handle data type
-        if (std::regex_match(strs[0], type)) {
-            type_ = static_cast<DataType>(std::stoi(strs[1]));
+        // Skip blank lines, comments, and anything else without a value
+        if (eq == eol) {
+            pos = eol;
+            continue;
         }
 
-        // Handle byte order
-        else if (std::regex_match(strs[0], endian)) {
-            endian_ = static_cast<Endianness>(std::stoi(strs[1]));
+        auto key = Lowered(Trimmed(pos, eq));
+        const auto* value = eq + 1;
+        while (value < eol && IsSpace(*value)) {
+            value++;
         }
 
-        // Handle interleave
-        else if (std::regex_match(strs[0], interleave)) {
-            if (strs[1] == "bsq") {
+        // Brace-enclosed values may span lines
+        if (value < eol && *value == '{') {
+            const auto* close = std::find(value, end, '}');
+            if (close == end) {
+                throw std::runtime_error(
+                    "Unterminated value for header field \"" + key + "\"");
+            }
+            fields_[key] = Trimmed(value + 1, close);
+            bracedFields_.insert(key);
+            pos = std::find(close, end, '\n');
+        } else {
+            fields_[key] = Trimmed(value, eol);
+            bracedFields_.erase(key);
+            pos = eol;
+        }
+    }
+
+    // Interpret the fields we know how to handle
+    for (const auto& f : fields_) {
+        const auto& key = f.first;
+        const auto& value = f.second;
+
+        if (key == "data type") {
+            type_ = static_cast<DataType>(ParseInt<int>(key, value));
+        } else if (key == "byte order") {
+            endian_ = static_cast<Endianness>(ParseInt<int>(key, value));
+        } else if (key == "interleave") {
+            auto il = Lowered(value);
+            if (il == "bsq") {
                 interleave_ = Interleave::BandSequential;
-            } else if (strs[1] == "bip") {
+            } else if (il == "bip") {
                 interleave_ = Interleave::BandByPixel;
-            } else if (strs[1] == "bil") {
+            } else if (il == "bil") {
                 interleave_ = Interleave::BandByLine;
             } else {
                 throw std::runtime_error("Unrecognized interleave type");
             }
+        } else if (key == "samples") {
+            samples_ = ParseInt<int>(key, value);
+        } else if (key == "lines") {
+            lines_ = ParseInt<int>(key, value);
+        } else if (key == "bands") {
+            bands_ = ParseInt<int>(key, value);
+        } else if (key == "header offset") {
+            headerOffset_ = ParseInt<uint64_t>(key, value);
+        } else if (key == "wavelength") {
+            wavelengths_ = SplitList(value);
+        } else if (key == "data ignore value") {
+            try {
+                ignoreValue_ = std::stod(value);
+                hasIgnoreValue_ = true;
+            } catch (const std::logic_error&) {
+                throw std::runtime_error(
+                    "Invalid value for header field \"" + key +
+                    "\": " + value);
+            }
         }
+    }
+}
 
-        // Handle dimensions
-        else if (std::regex_match(strs[0], samples)) {
-            samples_ = std::stoi(strs[1]);
-        } else if (std::regex_match(strs[0], lines)) {
-            lines_ = std::stoi(strs[1]);
-        } else if (std::regex_match(strs[0], bands)) {
-            bands_ = std::stoi(strs[1]);
-        }
+// Check for a header field
+bool ENVI::hasField(const std::string& key)
+{
+    return fields_.count(Lowered(key)) > 0;
+}
 
-        // Handle band IDs
-        else if (std::regex_match(strs[0], bandIDs)) {
-            std::vector<std::string> substr;
+// Get a header field's raw value
+std::string ENVI::getField(const std::string& key)
+{
+    auto it = fields_.find(Lowered(key));
+    if (it == fields_.end()) {
+        throw std::out_of_range("Header field not found: " + key);
+    }
+    return it->second;
+}
 
-            std::getline(ifs, line);
-            boost::trim(line);
-            while (line != "}") {
-                boost::trim_if(line, boost::is_any_of(","));
-                wavelengths_.push_back(line);
+// Get a header field's list value
+std::vector<std::string> ENVI::getFieldList(const std::string& key)
+{
+    return SplitList(getField(key));
+}
 
-                std::getline(ifs, line);
-                boost::trim(line);
-            }
-        }
+// Check whether a header field was braced
+bool ENVI::isBracedField(const std::string& key)
+{
+    return bracedFields_.count(Lowered(key)) > 0;
+}
 
-        // Clear and continue
-        strs.clear();
+// Get the name of every header field
+std::vector<std::string> ENVI::getFieldNames()
+{
+    std::vector<std::string> output;
+    output.reserve(fields_.size());
+    for (const auto& f : fields_) {
+        output.push_back(f.first);
     }
-
-    ifs.close();
+    return output;
 }
 
 // Find the image data file relative to the header location
@@ -121,71 +243,527 @@ void ENVI::find_data_file_(const boost::filesystem::path& header)
     throw std::runtime_error("Data file not found. Please specify manually");
 }
 
-// Don't try to reopen the file (for repeated access)
+// Don't try to reopen the file (for repeated access). Caller must hold
+// fileMutex_.
 void ENVI::open_file_()
 {
-    if (!ifs_.is_open()) {
-        ifs_.open(dataPath_.string(), std::ios::binary);
+    // Map the whole data file. Copy-on-write so that callers can safely
+    // modify the images returned by getBand()
+    if (accessMode_ == AccessMode::MemoryMapped) {
+        if (mapping_) {
+            return;
+        }
+        try {
+            bip::file_mapping file(dataPath_.c_str(), bip::read_only);
+            mapping_ =
+                std::make_shared<bip::mapped_region>(file, bip::copy_on_write);
+        } catch (const bip::interprocess_exception& e) {
+            throw std::runtime_error(
+                "Could not map ENVI data file: " + std::string(e.what()));
+        }
+        mapData_ = static_cast<char*>(mapping_->get_address());
+        mapSize_ = mapping_->get_size();
+        return;
     }
 
-    if (!ifs_.good()) {
+    if (fd_ < 0) {
+        fd_ = ::open(dataPath_.c_str(), O_RDONLY);
+    }
+
+    if (fd_ < 0) {
         throw std::runtime_error("Could not open ENVI data file");
     }
 }
 
+// Open the data file and count the read
+void ENVI::begin_read_()
+{
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    open_file_();
+    readers_++;
+}
+
+// Seek to a position in the data file and read a block of bytes
+void ENVI::read_bytes_(uint64_t pos, char* dst, size_t length)
+{
+    if (mapData_ != nullptr) {
+        check_mapped_range_(pos, length);
+        std::memcpy(dst, mapData_ + pos, length);
+        return;
+    }
+
+    // pread can return fewer bytes than requested
+    size_t total = 0;
+    while (total < length) {
+        auto result = ::pread(
+            fd_, dst + total, length - total,
+            static_cast<off_t>(pos + total));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            auto msg = "Only read " + std::to_string(total) +
+                       " bytes. Expected: " + std::to_string(length);
+            throw std::runtime_error(msg);
+        }
+        total += static_cast<size_t>(result);
+    }
+}
+
+// Ask the OS to read ahead. Hints are best effort, so errors are ignored.
+void ENVI::advise_range_(uint64_t pos, uint64_t length)
+{
+    if (mapData_ != nullptr) {
+#ifdef MADV_WILLNEED
+        if (pos >= mapSize_) {
+            return;
+        }
+        length = std::min(length, mapSize_ - pos);
+
+        // madvise needs a page-aligned address. The mapping starts on a page.
+        auto page = static_cast<uint64_t>(bip::mapped_region::get_page_size());
+        auto start = pos - pos % page;
+        ::madvise(
+            mapData_ + start, static_cast<size_t>(length + pos - start),
+            MADV_WILLNEED);
+#endif
+        return;
+    }
+
+#ifdef POSIX_FADV_WILLNEED
+    ::posix_fadvise(
+        fd_, static_cast<off_t>(pos), static_cast<off_t>(length),
+        POSIX_FADV_WILLNEED);
+#endif
+}
+
+// Make sure a block of bytes is inside of the mapped file
+void ENVI::check_mapped_range_(uint64_t pos, size_t length)
+{
+    if (pos > mapSize_ || length > mapSize_ - pos) {
+        auto avail = pos > mapSize_ ? 0 : mapSize_ - pos;
+        auto msg = "Only read " + std::to_string(avail) +
+                   " bytes. Expected: " + std::to_string(length);
+        throw std::runtime_error(msg);
+    }
+}
+
 // Close the data file if it's open
 void ENVI::closeFile()
 {
-    if (ifs_.is_open()) {
-        ifs_.close();
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    close_file_();
+}
+
+// Close the descriptor and mapping. Caller must hold fileMutex_.
+void ENVI::close_file_()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+    mapping_.reset();
+    mapData_ = nullptr;
+    mapSize_ = 0;
+}
+
+// Make sure a band index is in range
+void ENVI::check_band_(int b)
+{
+    if (b < 0 || b >= bands_) {
+        throw std::out_of_range("Band not in range: " + std::to_string(b));
+    }
+}
+
+// Make sure a pixel position is in range
+void ENVI::check_pixel_(int x, int y)
+{
+    if (x < 0 || x >= samples_ || y < 0 || y >= lines_) {
+        throw std::out_of_range(
+            "Pixel not in range: (" + std::to_string(x) + ", " +
+            std::to_string(y) + ")");
+    }
+}
+
+// Make sure a window is non-empty and inside of the band images
+void ENVI::check_region_(const Box& roi)
+{
+    if (roi.xmin < 0 || roi.ymin < 0 || roi.xmax > samples_ ||
+        roi.ymax > lines_ || roi.xmin >= roi.xmax || roi.ymin >= roi.ymax) {
+        throw std::out_of_range(
+            "Region not in range: (" + std::to_string(roi.xmin) + ", " +
+            std::to_string(roi.ymin) + ", " + std::to_string(roi.xmax) +
+            ", " + std::to_string(roi.ymax) + ")");
+    }
+}
+
+// Make sure a range of bands is in the file
+cv::Range ENVI::check_band_range_(cv::Range bands)
+{
+    if (bands == cv::Range::all()) {
+        bands = cv::Range(0, bands_);
+    }
+    if (bands.start < 0 || bands.end > bands_ || bands.start >= bands.end) {
+        throw std::out_of_range(
+            "Band range not in range: [" + std::to_string(bands.start) +
+            ", " + std::to_string(bands.end) + ")");
+    }
+    return bands;
+}
+
+// Close the file after the last read unless asked to keep it open
+void ENVI::finish_read_()
+{
+    std::lock_guard<std::mutex> lock(fileMutex_);
+    if (--readers_ == 0 && accessMode_ == AccessMode::CloseOnComplete) {
+        close_file_();
     }
 }
 
 // Get a specific band from the ENVI file
 cv::Mat ENVI::getBand(int b)
 {
-    if (b >= bands_) {
-        throw std::out_of_range("Band not in range: " + std::to_string(b));
+    check_band_(b);
+
+    cv::Mat output;
+    auto key = cache_key_(b, Box(0, 0, samples_, lines_));
+    if (cache_ && cache_->get(key, output)) {
+        return output;
+    }
+
+    ReadGuard guard(*this);
+    output = dispatch_type_([this, b](auto t) {
+        return this->get_band_<decltype(t)>(b);
+    });
+    to_output_type_(output);
+    cache_put_(key, output);
+    return output;
+}
+
+// Get a specific band converted to a new depth
+cv::Mat ENVI::getBand(int b, int depth, double scale, double offset)
+{
+    check_band_(b);
+
+    ReadGuard guard(*this);
+    return dispatch_file_type_([&](auto t) {
+        using T = decltype(t);
+        return dispatch_depth_(depth, [&](auto o) {
+            return this->get_band_as_<T, decltype(o)>(b, scale, offset);
+        });
+    });
+}
+
+// Get a specific band on a background thread
+std::future<cv::Mat> ENVI::getBandAsync(int b)
+{
+    return std::async(std::launch::async, [this, b]() { return getBand(b); });
+}
+
+// Start loading a list of bands into the page cache
+void ENVI::prefetchBands(const std::vector<int>& bands)
+{
+    for (const auto& b : bands) {
+        check_band_(b);
+    }
+    if (bands.empty()) {
+        return;
+    }
+
+    ReadGuard guard(*this);
+    auto length = elementSize();
+    auto rowBytes = static_cast<uint64_t>(samples_) * length;
+    auto lines = static_cast<uint64_t>(lines_);
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    switch (interleave_) {
+        // Each band is one contiguous block
+        case Interleave::BandSequential:
+            for (const auto& b : bands) {
+                auto band = static_cast<uint64_t>(b);
+                ranges.emplace_back(
+                    pos_of_elem_(band, 0, 0, length), rowBytes * lines);
+            }
+            break;
+        // Each line of a band is a contiguous block
+        case Interleave::BandByLine:
+            for (const auto& b : bands) {
+                auto band = static_cast<uint64_t>(b);
+                for (uint64_t y = 0; y < lines; y++) {
+                    ranges.emplace_back(
+                        pos_of_elem_(band, y, 0, length), rowBytes);
+                }
+            }
+            break;
+        // Every band is spread over the whole file, which is read from the
+        // first line. Read-ahead takes over after the first lines.
+        case Interleave::BandByPixel: {
+            auto lineBytes = rowBytes * static_cast<uint64_t>(bands_);
+            auto count = std::min(
+                lines, std::max<uint64_t>(1, PrefetchWindow / lineBytes));
+            ranges.emplace_back(
+                pos_of_elem_(0, 0, 0, length), lineBytes * count);
+            break;
+        }
+    }
+    advise_ranges_(ranges);
+}
+
+// Hint a list of ranges. Ranges which share or touch a page are merged so
+// that each run of pages costs one call.
+void ENVI::advise_ranges_(std::vector<std::pair<uint64_t, uint64_t>> ranges)
+{
+    if (ranges.empty()) {
+        return;
+    }
+
+    auto page = static_cast<uint64_t>(bip::mapped_region::get_page_size());
+    std::sort(ranges.begin(), ranges.end());
+
+    auto start = ranges.front().first;
+    auto end = start + ranges.front().second;
+    for (const auto& r : ranges) {
+        if (r.first / page > (end + page - 1) / page) {
+            advise_range_(start, end - start);
+            start = r.first;
+        }
+        end = std::max(end, r.first + r.second);
+    }
+    advise_range_(start, end - start);
+}
+
+// Get a list of bands from the ENVI file in a single pass
+std::vector<cv::Mat> ENVI::getBands(const std::vector<int>& bands)
+{
+    for (const auto& b : bands) {
+        check_band_(b);
     }
 
+    // Only read the bands which aren't cached
+    std::vector<cv::Mat> output(bands.size());
+    std::vector<int> missing;
+    std::vector<size_t> missingIdx;
+    Box window(0, 0, samples_, lines_);
+    for (size_t i = 0; i < bands.size(); i++) {
+        if (!cache_ || !cache_->get(cache_key_(bands[i], window), output[i])) {
+            missing.push_back(bands[i]);
+            missingIdx.push_back(i);
+        }
+    }
+    if (missing.empty()) {
+        return output;
+    }
+
+    ReadGuard guard(*this);
+    auto read = dispatch_type_([this, &missing](auto t) {
+        return this->get_bands_<decltype(t)>(missing);
+    });
+    to_output_type_(read);
+    for (size_t i = 0; i < missing.size(); i++) {
+        cache_put_(cache_key_(missing[i], window), read[i]);
+        output[missingIdx[i]] = read[i];
+    }
+    return output;
+}
+
+// Get every band from the ENVI file in a single pass
+std::vector<cv::Mat> ENVI::getBands()
+{
+    std::vector<int> bands(static_cast<size_t>(bands_));
+    std::iota(bands.begin(), bands.end(), 0);
+    return getBands(bands);
+}
+
+// Get the spectrum of a single pixel
+cv::Mat ENVI::getSpectrum(int x, int y)
+{
+    check_pixel_(x, y);
+    ReadGuard guard(*this);
+    auto output = dispatch_type_([this, x, y](auto t) {
+        return this->get_spectrum_<decltype(t)>(x, y);
+    });
+    to_output_type_(output);
+    return output;
+}
+
+// Get the spectra of a list of pixels
+cv::Mat ENVI::getSpectra(const std::vector<cv::Vec2i>& pts)
+{
+    for (const auto& pt : pts) {
+        check_pixel_(pt[0], pt[1]);
+    }
+    ReadGuard guard(*this);
+    auto output = dispatch_type_([this, &pts](auto t) {
+        return this->get_spectra_<decltype(t)>(pts);
+    });
+    to_output_type_(output);
+    return output;
+}
+
+// Get every spectrum in a line
+cv::Mat ENVI::getSpectralLine(int y)
+{
+    check_pixel_(0, y);
+    ReadGuard guard(*this);
+    auto output = dispatch_type_([this, y](auto t) {
+        return this->get_spectral_line_<decltype(t)>(y);
+    });
+    to_output_type_(output);
+    return output;
+}
+
+// Get a window of a range of bands
+std::vector<cv::Mat> ENVI::getRegion(const Box& roi, cv::Range bands)
+{
+    check_region_(roi);
+    bands = check_band_range_(bands);
+
+    // Use the cache if it holds every band
+    std::vector<cv::Mat> output(static_cast<size_t>(bands.size()));
+    auto cached = static_cast<bool>(cache_);
+    for (int b = bands.start; b < bands.end && cached; b++) {
+        auto& m = output[static_cast<size_t>(b - bands.start)];
+        cached = cache_->get(cache_key_(b, roi), m);
+    }
+    if (cached) {
+        return output;
+    }
+
+    ReadGuard guard(*this);
+    output = dispatch_type_([this, &roi, &bands](auto t) {
+        return this->get_region_<decltype(t)>(roi, bands);
+    });
+    to_output_type_(output);
+    for (int b = bands.start; b < bands.end; b++) {
+        auto& m = output[static_cast<size_t>(b - bands.start)];
+        cache_put_(cache_key_(b, roi), m);
+    }
+    return output;
+}
+
+// Get a window of a range of bands as stored
+std::vector<cv::Mat> ENVI::getRawRegion(const Box& roi, cv::Range bands)
+{
+    check_region_(roi);
+    bands = check_band_range_(bands);
+
+    ReadGuard guard(*this);
+    return dispatch_type_([this, &roi, &bands](auto t) {
+        return this->get_region_<decltype(t)>(roi, bands);
+    });
+}
+
+// Build the cache key for a band and window of this file
+BandCache::Key ENVI::cache_key_(int b, const Box& window)
+{
+    return {dataPath_.string(), b, window};
+}
+
+// Add a band to the cache. Images which point into the memory mapping are
+// skipped, since they are free to re-read and don't outlive the mapping.
+void ENVI::cache_put_(const BandCache::Key& key, const cv::Mat& img)
+{
+    if (!cache_) {
+        return;
+    }
+
+    if (mapData_ != nullptr) {
+        auto* data = reinterpret_cast<const char*>(img.data);
+        if (data >= mapData_ && data < mapData_ + mapSize_) {
+            return;
+        }
+    }
+
+    cache_->put(key, img);
+}
+
+// Convert raw storage bits to CV_64F for types OpenCV can't represent
+template <typename T, typename S>
+static cv::Mat WidenBits(const cv::Mat& img)
+{
+    static_assert(sizeof(T) == sizeof(S), "Storage size mismatch");
+    cv::Mat_<double> output(img.rows, img.cols);
+    for (int y = 0; y < img.rows; y++) {
+        const auto* src = img.ptr<S>(y);
+        auto* dst = output.ptr<double>(y);
+        for (int x = 0; x < img.cols; x++) {
+            T v;
+            std::memcpy(&v, src + x, sizeof(T));
+            dst[x] = static_cast<double>(v);
+        }
+    }
+    return output;
+}
+
+// Convert images of types without an OpenCV depth
+void ENVI::to_output_type_(cv::Mat& img)
+{
+    switch (type_) {
+        case DataType::Unsigned32:
+            img = WidenBits<uint32_t, int32_t>(img);
+            break;
+        case DataType::Signed64:
+            img = WidenBits<int64_t, double>(img);
+            break;
+        case DataType::Unsigned64:
+            img = WidenBits<uint64_t, double>(img);
+            break;
+        default:
+            break;
+    }
+}
+
+// Size of a single element based on the datatype
+size_t ENVI::elementSize()
+{
     switch (type_) {
         case DataType::Unsigned8:
-            return get_band_<uint8_t>(b);
+            return 1;
         case DataType::Signed16:
-            return get_band_<int16_t>(b);
+        case DataType::Unsigned16:
+            return 2;
         case DataType::Signed32:
-            return get_band_<int32_t>(b);
+        case DataType::Unsigned32:
         case DataType::Float32:
-            return get_band_<float>(b);
+            return 4;
         case DataType::Float64:
-            return get_band_<double>(b);
         case DataType::Complex32:
-            throw std::runtime_error("Complex ENVI files are unsupported");
-        case DataType::Complex64:
-            throw std::runtime_error("Complex ENVI files are unsupported");
-        case DataType::Unsigned16:
-            return get_band_<uint16_t>(b);
-        case DataType::Unsigned32:
-            throw std::runtime_error("32-bit Integer ENVI files are unsupported");
         case DataType::Signed64:
-            throw std::runtime_error("64-bit Integer ENVI files are unsupported");
         case DataType::Unsigned64:
-            throw std::runtime_error("64-bit Integer ENVI files are unsupported");
+            return 8;
+        case DataType::Complex64:
+            return 16;
     }
+    return 0;
+}
+
+// Number of whole bands which fit in maxBytes
+size_t ENVI::bandsPerBatch(size_t maxBytes)
+{
+    auto bandBytes = elementSize() * static_cast<size_t>(samples_) *
+                     static_cast<size_t>(lines_);
+    return std::max<size_t>(1, maxBytes / std::max<size_t>(1, bandBytes));
 }
 
 // Calculate byte position of pixel inside of data file based on interleave
 uint64_t ENVI::pos_of_elem_(
     uint64_t band, uint64_t y, uint64_t x, uint64_t size)
 {
+    auto samples = static_cast<uint64_t>(samples_);
+    auto lines = static_cast<uint64_t>(lines_);
+    auto bands = static_cast<uint64_t>(bands_);
     switch (interleave_) {
         case Interleave::BandSequential:
-            return size * ((samples_ * lines_ * band) + (samples_ * y) + x);
+            return headerOffset_ +
+                   size * ((samples * lines * band) + (samples * y) + x);
         case Interleave::BandByPixel:
-            return size * ((bands_ * samples_ * y) + (bands_ * x) + band);
+            return headerOffset_ +
+                   size * ((bands * samples * y) + (bands * x) + band);
         case Interleave::BandByLine:
-            return size * ((samples_ * bands_ * y) + (samples_ * band) + x);
+            return headerOffset_ +
+                   size * ((samples * bands * y) + (samples * band) + x);
     }
+    return headerOffset_;
 }
 
 // Print the parsed values of the header
@@ -212,5 +790,6 @@ void ENVI::printHeader()
     std::cerr << "Samples (Width): " << samples_ << std::endl;
     std::cerr << "Lines (Height): " << lines_ << std::endl;
     std::cerr << "Bands (Depth): " << bands_ << std::endl;
+    std::cerr << "Header offset: " << headerOffset_ << std::endl;
     std::cerr << "Band ID count: " << wavelengths_.size() << std::endl;
 }
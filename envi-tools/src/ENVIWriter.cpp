@@ -0,0 +1,369 @@
+#include "envitools/ENVIWriter.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+#include <boost/algorithm/string.hpp>
+
+using namespace envitools;
+namespace fs = boost::filesystem;
+
+// Size of the data file stream buffer
+static constexpr size_t StreamBufferSize = 4 * 1024 * 1024;
+
+// OpenCV type which holds an ENVI datatype. Datatypes without an OpenCV
+// depth are held as raw values in a type of the same size, the same as
+// ENVI::getRawRegion().
+static int CVType(ENVI::DataType type)
+{
+    switch (type) {
+        case ENVI::DataType::Unsigned8:
+            return CV_8UC1;
+        case ENVI::DataType::Signed16:
+            return CV_16SC1;
+        case ENVI::DataType::Signed32:
+        case ENVI::DataType::Unsigned32:
+            return CV_32SC1;
+        case ENVI::DataType::Float32:
+            return CV_32FC1;
+        case ENVI::DataType::Float64:
+        case ENVI::DataType::Signed64:
+        case ENVI::DataType::Unsigned64:
+            return CV_64FC1;
+        case ENVI::DataType::Complex32:
+            return CV_32FC2;
+        case ENVI::DataType::Complex64:
+            return CV_64FC2;
+        case ENVI::DataType::Unsigned16:
+            return CV_16UC1;
+    }
+    throw std::runtime_error("Unknown ENVI data type");
+}
+
+// Header fields written from the writer's own state
+static const std::array<std::string, 9> LayoutFields{
+    "samples",   "lines",      "bands",      "header offset", "file type",
+    "data type", "interleave", "byte order", "wavelength"};
+
+// Open the data file
+ENVIWriter::ENVIWriter(
+    fs::path header,
+    int width,
+    int height,
+    int bands,
+    ENVI::DataType type,
+    ENVI::Interleave interleave)
+    : headerPath_{std::move(header)}
+    , samples_{width}
+    , lines_{height}
+    , bands_{bands}
+    , type_{type}
+    , interleave_{interleave}
+{
+    if (samples_ <= 0 || lines_ <= 0 || bands_ <= 0) {
+        throw std::invalid_argument("ENVI dimensions must be positive");
+    }
+
+    // Validate the datatype before creating any files
+    CVType(type_);
+
+    // Data file is the header path without an extension
+    dataPath_ = headerPath_;
+    dataPath_.replace_extension("");
+    if (dataPath_ == headerPath_) {
+        throw std::invalid_argument("Header path must have an extension");
+    }
+
+    streamBuffer_.resize(StreamBufferSize);
+    ofs_.rdbuf()->pubsetbuf(
+        streamBuffer_.data(), static_cast<std::streamsize>(StreamBufferSize));
+    ofs_.open(dataPath_.string(), std::ios::binary | std::ios::trunc);
+    if (!ofs_.good()) {
+        throw std::runtime_error("Could not open ENVI data file for writing");
+    }
+}
+
+// Finish the file if the user didn't
+ENVIWriter::~ENVIWriter()
+{
+    try {
+        close();
+    } catch (const std::exception& e) {
+        std::cerr << "ENVIWriter: " << e.what() << std::endl;
+    }
+}
+
+// Check whether the writer fills in a header field itself
+bool ENVIWriter::IsLayoutField(const std::string& key)
+{
+    auto lowered = boost::algorithm::to_lower_copy(boost::trim_copy(key));
+    return std::find(LayoutFields.begin(), LayoutFields.end(), lowered) !=
+           LayoutFields.end();
+}
+
+// Set an extra header field
+void ENVIWriter::setField(
+    const std::string& key, std::string value, bool braced)
+{
+    auto lowered = boost::algorithm::to_lower_copy(boost::trim_copy(key));
+    if (lowered.empty() || IsLayoutField(lowered)) {
+        throw std::invalid_argument("Cannot set header field: " + key);
+    }
+    if (braced || value.find_first_of(",\n") != std::string::npos) {
+        bracedFields_.insert(lowered);
+    } else {
+        bracedFields_.erase(lowered);
+    }
+    fields_[lowered] = std::move(value);
+}
+
+// Append a band
+void ENVIWriter::writeBand(const cv::Mat& band)
+{
+    if (interleave_ != ENVI::Interleave::BandSequential) {
+        throw std::logic_error("writeBand() requires a BSQ file");
+    }
+    if (byLines_) {
+        throw std::logic_error("Cannot mix writeBand() and writeLines()");
+    }
+    if (written_ >= bands_) {
+        throw std::out_of_range("All bands have already been written");
+    }
+    if (band.rows != lines_ || band.cols != samples_) {
+        throw std::invalid_argument("Band size does not match file size");
+    }
+    check_type_(band);
+
+    // Whole band in one write if possible
+    auto rowBytes = static_cast<size_t>(samples_) * band.elemSize();
+    if (band.isContinuous()) {
+        write_bytes_(
+            reinterpret_cast<const char*>(band.data),
+            rowBytes * static_cast<size_t>(lines_));
+    } else {
+        for (int y = 0; y < lines_; y++) {
+            write_bytes_(reinterpret_cast<const char*>(band.ptr(y)), rowBytes);
+        }
+    }
+    written_++;
+}
+
+// Append a line
+void ENVIWriter::writeLine(const cv::Mat& line)
+{
+    if (interleave_ == ENVI::Interleave::BandSequential) {
+        throw std::logic_error("writeLine() requires a BIL or BIP file");
+    }
+    if (written_ >= lines_) {
+        throw std::out_of_range("All lines have already been written");
+    }
+    if (line.rows != bands_ || line.cols != samples_) {
+        throw std::invalid_argument("Line size does not match file size");
+    }
+    check_type_(line);
+
+    std::vector<const uchar*> rows(static_cast<size_t>(bands_));
+    for (int b = 0; b < bands_; b++) {
+        rows[static_cast<size_t>(b)] = line.ptr(b);
+    }
+    write_line_(rows, line.elemSize());
+    written_++;
+}
+
+// Append a block of lines of every band
+void ENVIWriter::writeLines(const std::vector<cv::Mat>& bands)
+{
+    if (bands.size() != static_cast<size_t>(bands_)) {
+        throw std::invalid_argument("Need one image per band");
+    }
+    if (interleave_ == ENVI::Interleave::BandSequential) {
+        if (written_ > 0 && !byLines_) {
+            throw std::logic_error("Cannot mix writeBand() and writeLines()");
+        }
+        byLines_ = true;
+    }
+
+    auto count = bands.front().rows;
+    for (const auto& b : bands) {
+        if (b.rows != count || b.cols != samples_) {
+            throw std::invalid_argument("Band sizes do not match file size");
+        }
+        check_type_(b);
+    }
+    if (count > lines_ - written_) {
+        throw std::out_of_range("Too many lines for file size");
+    }
+
+    auto elemSize = bands.front().elemSize();
+    auto rowBytes = static_cast<size_t>(samples_) * elemSize;
+
+    // BSQ: rows of each band are contiguous at the band's offset
+    if (interleave_ == ENVI::Interleave::BandSequential) {
+        auto bandBytes = rowBytes * static_cast<size_t>(lines_);
+        for (int b = 0; b < bands_; b++) {
+            const auto& m = bands[static_cast<size_t>(b)];
+            auto pos = static_cast<size_t>(b) * bandBytes +
+                       static_cast<size_t>(written_) * rowBytes;
+            ofs_.seekp(static_cast<std::streamoff>(pos));
+            for (int y = 0; y < count; y++) {
+                write_bytes_(reinterpret_cast<const char*>(m.ptr(y)), rowBytes);
+            }
+        }
+    }
+
+    // BIL and BIP: one line at a time
+    else {
+        std::vector<const uchar*> rows(static_cast<size_t>(bands_));
+        for (int y = 0; y < count; y++) {
+            for (int b = 0; b < bands_; b++) {
+                auto i = static_cast<size_t>(b);
+                rows[i] = bands[i].ptr(y);
+            }
+            write_line_(rows, elemSize);
+        }
+    }
+    written_ += count;
+}
+
+// Write one line given the row of each band
+void ENVIWriter::write_line_(
+    const std::vector<const uchar*>& rows, size_t elemSize)
+{
+    auto rowBytes = static_cast<size_t>(samples_) * elemSize;
+
+    // BIL lines are already bands x samples
+    if (interleave_ == ENVI::Interleave::BandByLine) {
+        for (const auto& r : rows) {
+            write_bytes_(reinterpret_cast<const char*>(r), rowBytes);
+        }
+        return;
+    }
+
+    // BIP lines are samples x bands. Interleave into the scratch buffer in
+    // blocks of pixels, so that the source rows and destination stay in
+    // cache.
+    constexpr int blockSize = 64;
+    lineBuffer_.resize(rowBytes * rows.size());
+    auto pixelBytes = elemSize * rows.size();
+    for (int x0 = 0; x0 < samples_; x0 += blockSize) {
+        auto x1 = std::min(x0 + blockSize, samples_);
+        for (size_t b = 0; b < rows.size(); b++) {
+            const auto* src = rows[b] + static_cast<size_t>(x0) * elemSize;
+            auto* dst = lineBuffer_.data() + b * elemSize +
+                        static_cast<size_t>(x0) * pixelBytes;
+            for (int x = x0; x < x1; x++) {
+                std::memcpy(dst, src, elemSize);
+                src += elemSize;
+                dst += pixelBytes;
+            }
+        }
+    }
+    write_bytes_(lineBuffer_.data(), lineBuffer_.size());
+}
+
+// Flush data and write the header
+void ENVIWriter::close()
+{
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+
+    ofs_.close();
+    auto dataFailed = ofs_.fail();
+    write_header_();
+
+    if (dataFailed) {
+        throw std::runtime_error("Failed to write ENVI data file");
+    }
+
+    auto byBands =
+        interleave_ == ENVI::Interleave::BandSequential && !byLines_;
+    auto expected = byBands ? bands_ : lines_;
+    if (written_ != expected) {
+        auto msg = "Incomplete ENVI file. Wrote " + std::to_string(written_) +
+                   " of " + std::to_string(expected) +
+                   (byBands ? " bands" : " lines");
+        throw std::runtime_error(msg);
+    }
+}
+
+// Make sure an image holds the file's datatype
+void ENVIWriter::check_type_(const cv::Mat& img)
+{
+    if (img.type() != CVType(type_)) {
+        throw std::invalid_argument("Image type does not match file datatype");
+    }
+}
+
+// Write the header
+void ENVIWriter::write_header_()
+{
+    std::ofstream ofs(headerPath_.string());
+    if (!ofs.good()) {
+        throw std::runtime_error("Could not open ENVI header for writing");
+    }
+
+    ofs << "ENVI" << std::endl;
+    ofs << "samples = " << samples_ << std::endl;
+    ofs << "lines = " << lines_ << std::endl;
+    ofs << "bands = " << bands_ << std::endl;
+    ofs << "header offset = 0" << std::endl;
+    ofs << "file type = ENVI Standard" << std::endl;
+    ofs << "data type = " << static_cast<int>(type_) << std::endl;
+
+    ofs << "interleave = ";
+    switch (interleave_) {
+        case ENVI::Interleave::BandSequential:
+            ofs << "bsq";
+            break;
+        case ENVI::Interleave::BandByPixel:
+            ofs << "bip";
+            break;
+        case ENVI::Interleave::BandByLine:
+            ofs << "bil";
+            break;
+    }
+    ofs << std::endl;
+
+    ofs << "byte order = " << (HostIsBigEndian() ? 1 : 0) << std::endl;
+
+    if (!wavelengths_.empty()) {
+        ofs << "wavelength = {" << std::endl;
+        for (size_t i = 0; i < wavelengths_.size(); i++) {
+            ofs << "  " << wavelengths_[i];
+            if (i + 1 < wavelengths_.size()) {
+                ofs << ",";
+            }
+            ofs << std::endl;
+        }
+        ofs << "}" << std::endl;
+    }
+
+    // Lists and multi-line values must be enclosed in braces
+    for (const auto& f : fields_) {
+        ofs << f.first << " = ";
+        if (bracedFields_.count(f.first) > 0) {
+            ofs << "{" << f.second << "}";
+        } else {
+            ofs << f.second;
+        }
+        ofs << std::endl;
+    }
+
+    if (ofs.fail()) {
+        throw std::runtime_error("Failed to write ENVI header");
+    }
+}
+
+// Write to the data file
+void ENVIWriter::write_bytes_(const char* data, size_t length)
+{
+    ofs_.write(data, static_cast<std::streamsize>(length));
+    if (ofs_.fail()) {
+        throw std::runtime_error("Failed to write ENVI data file");
+    }
+}
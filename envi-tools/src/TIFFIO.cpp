@@ -1,5 +1,15 @@
 #include "envitools/TIFFIO.hpp"
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include <boost/algorithm/string.hpp>
 #include <opencv2/imgproc.hpp>
 
@@ -12,26 +22,433 @@ namespace lt
 namespace tio = envitools::TIFFIO;
 namespace fs = boost::filesystem;
 
-// Write a TIFF to a file. This implementation heavily borrows from how OpenCV's
-// TIFFEncoder writes to the TIFF
-void tio::WriteTIFF(const fs::path& path, const cv::Mat& img)
+// Uncompressed size of each strip when the number of rows isn't given
+static constexpr size_t DefaultStripBytes = 256 * 1024;
+
+// Closes a TIFF when it goes out of scope
+using TIFFHandle = std::unique_ptr<lt::TIFF, decltype(&lt::TIFFClose)>;
+
+// Get the libtiff compression tag value for a compression scheme
+static uint16_t CompressionTag(tio::Compression compression)
 {
-    // Safety checks
-    if (img.channels() != 1 && img.channels() != 3) {
-        throw std::runtime_error("Unsupported number of channels");
+    uint16_t tag{COMPRESSION_NONE};
+    switch (compression) {
+        case tio::Compression::None:
+            tag = COMPRESSION_NONE;
+            break;
+        case tio::Compression::LZW:
+            tag = COMPRESSION_LZW;
+            break;
+        case tio::Compression::Deflate:
+            tag = COMPRESSION_ADOBE_DEFLATE;
+            break;
+        case tio::Compression::ZSTD:
+#ifdef COMPRESSION_ZSTD
+            tag = COMPRESSION_ZSTD;
+            break;
+#else
+            throw std::runtime_error(
+                "ZSTD compression requires libtiff 4.0.10 or later");
+#endif
     }
 
-    auto ext = path.extension().string();
-    boost::to_upper(ext);
-    if (ext != ".TIF" && ext != ".TIFF") {
-        throw std::runtime_error("Invalid file extension " + ext);
+    if (lt::TIFFIsCODECConfigured(tag) == 0) {
+        throw std::runtime_error(
+            "Compression scheme not supported by libtiff: " +
+            std::to_string(tag));
+    }
+    return tag;
+}
+
+// Set the compression, level, and predictor tags
+static void SetCompression(
+    lt::TIFF* out, const tio::WriteOptions& opts, int sampleFormat)
+{
+    auto tag = CompressionTag(opts.compression);
+    lt::TIFFSetField(out, TIFFTAG_COMPRESSION, tag);
+
+    if (opts.level > 0 && opts.compression == tio::Compression::Deflate) {
+        lt::TIFFSetField(out, TIFFTAG_ZIPQUALITY, opts.level);
+    }
+#ifdef TIFFTAG_ZSTD_LEVEL
+    if (opts.level > 0 && opts.compression == tio::Compression::ZSTD) {
+        lt::TIFFSetField(out, TIFFTAG_ZSTD_LEVEL, opts.level);
+    }
+#endif
+
+    if (opts.predictor && tag != COMPRESSION_NONE) {
+        auto predictor = sampleFormat == SAMPLEFORMAT_IEEEFP
+                             ? PREDICTOR_FLOATINGPOINT
+                             : PREDICTOR_HORIZONTAL;
+        lt::TIFFSetField(out, TIFFTAG_PREDICTOR, predictor);
+    }
+}
+
+// Pixel format and encoding of an image
+struct Encoding {
+    int photometric;
+    int sampleFormat;
+    int bitsPerSample;
+    int channels;
+    size_t pixelBytes;
+    tio::WriteOptions opts;
+};
+
+// Set every tag needed to write an image of the given size. rowsPerStrip is
+// ignored when writing tiles.
+static void SetTags(
+    lt::TIFF* out,
+    const Encoding& enc,
+    unsigned width,
+    unsigned height,
+    unsigned rowsPerStrip)
+{
+    lt::TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width);
+    lt::TIFFSetField(out, TIFFTAG_IMAGELENGTH, height);
+    lt::TIFFSetField(out, TIFFTAG_PHOTOMETRIC, enc.photometric);
+    lt::TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    lt::TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, enc.sampleFormat);
+    lt::TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, enc.bitsPerSample);
+    lt::TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, enc.channels);
+    if (enc.opts.tiled) {
+        lt::TIFFSetField(out, TIFFTAG_TILEWIDTH, enc.opts.tileSize);
+        lt::TIFFSetField(out, TIFFTAG_TILELENGTH, enc.opts.tileSize);
+    } else {
+        lt::TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+    }
+    SetCompression(out, enc.opts, enc.sampleFormat);
+}
+
+// Strips or tiles of an image. Block i covers the pixels starting at column
+// (i % across) * width and row (i / across) * height, the same order as
+// libtiff's strip and tile numbers.
+struct Layout {
+    // Whether the blocks are tiles
+    bool tiled;
+    // Width and height of each block. The last strip may be shorter.
+    unsigned width;
+    unsigned height;
+    // Number of blocks in each row of blocks, and in total
+    unsigned across;
+    unsigned count;
+};
+
+// Get the strip or tile layout of an image
+static Layout MakeLayout(
+    const cv::Mat& img, const tio::WriteOptions& opts, unsigned rowsPerStrip)
+{
+    auto width = static_cast<unsigned>(img.cols);
+    auto height = static_cast<unsigned>(img.rows);
+    if (opts.tiled) {
+        auto size = static_cast<unsigned>(opts.tileSize);
+        auto across = (width + size - 1) / size;
+        auto down = (height + size - 1) / size;
+        return {true, size, size, across, across * down};
+    }
+    return {false, width, rowsPerStrip, 1,
+            (height + rowsPerStrip - 1) / rowsPerStrip};
+}
+
+// Get block i of the image. Returns a pointer to the block's pixels in img if
+// possible, otherwise copies them into buffer. Tiles on the right and bottom
+// edges are padded with zeros.
+static void* GetBlock(
+    const cv::Mat& img,
+    const Layout& layout,
+    unsigned i,
+    bool copy,
+    std::vector<char>& buffer,
+    size_t& size)
+{
+    auto width = static_cast<unsigned>(img.cols);
+    auto height = static_cast<unsigned>(img.rows);
+    auto pixelBytes = img.elemSize();
+    auto x = (i % layout.across) * layout.width;
+    auto y = (i / layout.across) * layout.height;
+    auto rows = std::min(layout.height, height - y);
+    auto cols = std::min(layout.width, width - x);
+
+    // Strips of continuous images are already contiguous
+    auto blockRowBytes = layout.width * pixelBytes;
+    if (!layout.tiled && !copy && img.isContinuous()) {
+        size = rows * blockRowBytes;
+        return const_cast<uchar*>(img.ptr(static_cast<int>(y)));
+    }
+
+    auto blockRows = layout.tiled ? layout.height : rows;
+    size = blockRows * blockRowBytes;
+    buffer.resize(size);
+    if (rows < blockRows || cols < layout.width) {
+        std::fill(buffer.begin(), buffer.end(), 0);
+    }
+    for (unsigned r = 0; r < rows; r++) {
+        std::memcpy(
+            &buffer[r * blockRowBytes],
+            img.ptr(static_cast<int>(y + r)) + x * pixelBytes,
+            cols * pixelBytes);
+    }
+    return buffer.data();
+}
+
+// Encode and write every block of the image. Predictors difference the
+// samples in place, so libtiff must be given a copy when one is used.
+static void WriteBlocks(
+    lt::TIFF* out, const cv::Mat& img, const Layout& layout, bool copy)
+{
+    std::vector<char> buffer;
+    for (unsigned i = 0; i < layout.count; i++) {
+        size_t size;
+        auto data = GetBlock(img, layout, i, copy, buffer, size);
+        auto length = static_cast<lt::tmsize_t>(size);
+        auto result = layout.tiled
+                          ? lt::TIFFWriteEncodedTile(out, i, data, length)
+                          : lt::TIFFWriteEncodedStrip(out, i, data, length);
+        if (result == -1) {
+            auto msg = "Failed to write block " + std::to_string(i);
+            throw std::runtime_error(msg);
+        }
+    }
+}
+
+// Growable in-memory file for TIFFClientOpen()
+struct MemoryFile {
+    std::vector<char> data;
+    uint64_t pos{0};
+};
+
+static lt::tmsize_t MemoryRead(lt::thandle_t, void*, lt::tmsize_t)
+{
+    return 0;
+}
+
+static lt::tmsize_t MemoryWrite(
+    lt::thandle_t handle, void* buf, lt::tmsize_t size)
+{
+    auto file = static_cast<MemoryFile*>(handle);
+    auto length = static_cast<size_t>(size);
+    if (file->pos + length > file->data.size()) {
+        file->data.resize(file->pos + length);
+    }
+    std::memcpy(&file->data[file->pos], buf, length);
+    file->pos += length;
+    return size;
+}
+
+static lt::toff_t MemorySeek(lt::thandle_t handle, lt::toff_t off, int whence)
+{
+    auto file = static_cast<MemoryFile*>(handle);
+    switch (whence) {
+        case SEEK_CUR:
+            file->pos += off;
+            break;
+        case SEEK_END:
+            file->pos = file->data.size() + off;
+            break;
+        default:
+            file->pos = off;
+            break;
+    }
+    return file->pos;
+}
+
+static int MemoryClose(lt::thandle_t) { return 0; }
+
+static lt::toff_t MemorySize(lt::thandle_t handle)
+{
+    return static_cast<MemoryFile*>(handle)->data.size();
+}
+
+static int MemoryMap(lt::thandle_t, void**, lt::toff_t*) { return 0; }
+
+static void MemoryUnmap(lt::thandle_t, void*, lt::toff_t) {}
+
+// Compress one block with libtiff's codecs. libtiff can't encode blocks of
+// one file on several threads, so the block is written as the only block of
+// its own in-memory TIFF, and its compressed bytes are copied back out.
+static std::vector<char> EncodeBlock(
+    const Encoding& enc, const Layout& layout, void* data, size_t size)
+{
+    MemoryFile file;
+    TIFFHandle handle(
+        lt::TIFFClientOpen(
+            "memory", "wm", &file, MemoryRead, MemoryWrite, MemorySeek,
+            MemoryClose, MemorySize, MemoryMap, MemoryUnmap),
+        &lt::TIFFClose);
+    if (!handle) {
+        throw std::runtime_error("Failed to create in-memory TIFF");
     }
+    auto t = handle.get();
 
+    // Same size as the block, so it's a single strip or tile
+    auto height = static_cast<unsigned>(size / (layout.width * enc.pixelBytes));
+    SetTags(t, enc, layout.width, height, height);
+
+    auto length = static_cast<lt::tmsize_t>(size);
+    lt::toff_t* offsets{nullptr};
+    lt::toff_t* counts{nullptr};
+    if (layout.tiled) {
+        if (lt::TIFFWriteEncodedTile(t, 0, data, length) == -1) {
+            throw std::runtime_error("Failed to encode tile");
+        }
+        lt::TIFFGetField(t, TIFFTAG_TILEOFFSETS, &offsets);
+        lt::TIFFGetField(t, TIFFTAG_TILEBYTECOUNTS, &counts);
+    } else {
+        if (lt::TIFFWriteEncodedStrip(t, 0, data, length) == -1) {
+            throw std::runtime_error("Failed to encode strip");
+        }
+        lt::TIFFGetField(t, TIFFTAG_STRIPOFFSETS, &offsets);
+        lt::TIFFGetField(t, TIFFTAG_STRIPBYTECOUNTS, &counts);
+    }
+    if (offsets == nullptr || counts == nullptr ||
+        offsets[0] + counts[0] > file.data.size()) {
+        throw std::runtime_error("Failed to encode block");
+    }
+
+    auto begin = file.data.begin() + static_cast<std::ptrdiff_t>(offsets[0]);
+    return {begin, begin + static_cast<std::ptrdiff_t>(counts[0])};
+}
+
+// Compress the blocks on a pool of threads and write them to the file in
+// order as raw strips or tiles. At most a few blocks per thread are held in
+// memory at once.
+static void WriteBlocksParallel(
+    lt::TIFF* out,
+    const cv::Mat& img,
+    const Encoding& enc,
+    const Layout& layout,
+    unsigned threads)
+{
+    std::vector<std::vector<char>> encoded(layout.count);
+    std::vector<bool> ready(layout.count, false);
+    auto window = static_cast<size_t>(threads) * 4;
+
+    // Guarded by mutex
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t next{0};
+    size_t written{0};
+    std::exception_ptr error;
+
+    auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) {
+            error = e;
+        }
+        changed.notify_all();
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            std::vector<char> buffer;
+            while (true) {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() {
+                        return error || next >= layout.count ||
+                               next < written + window;
+                    });
+                    if (error || next >= layout.count) {
+                        return;
+                    }
+                    i = next++;
+                }
+
+                try {
+                    size_t size;
+                    auto data = GetBlock(
+                        img, layout, static_cast<unsigned>(i), true, buffer,
+                        size);
+                    auto bytes = EncodeBlock(enc, layout, data, size);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    encoded[i] = std::move(bytes);
+                    ready[i] = true;
+                    changed.notify_all();
+                } catch (...) {
+                    fail(std::current_exception());
+                    return;
+                }
+            }
+        });
+    }
+
+    // Write each block as soon as it and every block before it are ready
+    for (unsigned i = 0; i < layout.count; i++) {
+        std::vector<char> bytes;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return error || ready[i]; });
+            if (error) {
+                break;
+            }
+            bytes = std::move(encoded[i]);
+        }
+
+        auto length = static_cast<lt::tmsize_t>(bytes.size());
+        auto result = layout.tiled
+                          ? lt::TIFFWriteRawTile(out, i, bytes.data(), length)
+                          : lt::TIFFWriteRawStrip(out, i, bytes.data(), length);
+        if (result == -1) {
+            auto msg = "Failed to write block " + std::to_string(i);
+            fail(std::make_exception_ptr(std::runtime_error(msg)));
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        written = i + 1;
+        changed.notify_all();
+    }
+
+    for (auto& w : workers) {
+        w.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Throw if the options can't be used to write a TIFF
+static void CheckOptions(const tio::WriteOptions& opts)
+{
+    if (opts.tiled && (opts.tileSize <= 0 || opts.tileSize % 16 != 0)) {
+        throw std::invalid_argument(
+            "Tile size must be a positive multiple of 16: " +
+            std::to_string(opts.tileSize));
+    }
+
+    // Fail on unsupported compression before creating the file
+    CompressionTag(opts.compression);
+}
+
+// Throw if an image can't be written with the given options
+static void CheckImage(const cv::Mat& img, const tio::WriteOptions& opts)
+{
+    if (img.channels() != 1 && img.channels() != 3) {
+        throw std::runtime_error("Unsupported number of channels");
+    }
+    CheckOptions(opts);
+}
+
+// Encode an image into the current directory of an open TIFF. This
+// implementation heavily borrows from how OpenCV's TIFFEncoder writes to the
+// TIFF
+static void WritePage(
+    lt::TIFF* out, const cv::Mat& img, const tio::WriteOptions& opts)
+{
     // Image metadata
     auto channels = img.channels();
     auto width = static_cast<unsigned>(img.cols);
     auto height = static_cast<unsigned>(img.rows);
-    auto rowsPerStrip = height;
+
+    // Default to strips of about DefaultStripBytes
+    auto rowBytes = std::max<size_t>(1, width * img.elemSize());
+    auto rowsPerStrip = static_cast<unsigned>(opts.rowsPerStrip);
+    if (opts.rowsPerStrip <= 0) {
+        rowsPerStrip = static_cast<unsigned>(
+            std::max<size_t>(1, DefaultStripBytes / rowBytes));
+    }
+    rowsPerStrip = std::max(1u, std::min(rowsPerStrip, height));
 
     // Sample format
     int bitsPerSample;
@@ -53,6 +470,10 @@ void tio::WriteTIFF(const fs::path& path, const cv::Mat& img)
             sampleFormat = SAMPLEFORMAT_INT;
             bitsPerSample = 16;
             break;
+        case CV_32S:
+            sampleFormat = SAMPLEFORMAT_INT;
+            bitsPerSample = 32;
+            break;
         case CV_32F:
             sampleFormat = SAMPLEFORMAT_IEEEFP;
             bitsPerSample = 32;
@@ -78,27 +499,11 @@ void tio::WriteTIFF(const fs::path& path, const cv::Mat& img)
             throw std::runtime_error("Unsupported number of channels");
     }
 
-    // Open the file
-    auto out = lt::TIFFOpen(path.c_str(), "w");
-    if (out == nullptr) {
-        throw std::runtime_error("Failed to open file for writing");
-    }
-
     // Encoding parameters
-    lt::TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width);
-    lt::TIFFSetField(out, TIFFTAG_IMAGELENGTH, height);
-    lt::TIFFSetField(out, TIFFTAG_PHOTOMETRIC, photometric);
-    lt::TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-    lt::TIFFSetField(out, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
-    lt::TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, sampleFormat);
-    lt::TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, bitsPerSample);
-    lt::TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, channels);
-    lt::TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
-
-    // Row buffer. OpenCV documentation mentions that TIFFWriteScanline
-    // modifies its read buffer, so we can't use the cv::Mat directly
-    auto bufferSize = static_cast<size_t>(lt::TIFFScanlineSize(out));
-    std::vector<char> buffer(bufferSize + 32);
+    Encoding enc{
+        photometric, sampleFormat, bitsPerSample, channels, img.elemSize(),
+        opts};
+    SetTags(out, enc, width, height, rowsPerStrip);
 
     // Get working copy, with converted channels if it's 3 channel
     cv::Mat imgCopy;
@@ -108,17 +513,282 @@ void tio::WriteTIFF(const fs::path& path, const cv::Mat& img)
         imgCopy = img;
     }
 
-    // For each row
-    for (unsigned row = 0; row < height; row++) {
-        memcpy(&buffer[0], imgCopy.ptr(row), bufferSize);
-        auto result = lt::TIFFWriteScanline(out, &buffer[0], row, 0);
-        if (result == -1) {
-            lt::TIFFClose(out);
-            auto msg = "Failed to write row " + std::to_string(row);
-            throw std::runtime_error(msg);
+    // Compress blocks in parallel when there's work to share
+    auto layout = MakeLayout(imgCopy, opts, rowsPerStrip);
+    auto threads = opts.threads > 0 ? opts.threads
+                                    : std::thread::hardware_concurrency();
+    threads = std::min(threads, layout.count);
+    if (threads > 1 && opts.compression != tio::Compression::None) {
+        WriteBlocksParallel(out, imgCopy, enc, layout, threads);
+    } else {
+        WriteBlocks(out, imgCopy, layout, opts.predictor);
+    }
+}
+
+// Open a TIFF for writing. Mode "w8" writes a BigTIFF.
+static TIFFHandle OpenForWriting(const fs::path& path, const char* mode)
+{
+    auto ext = path.extension().string();
+    boost::to_upper(ext);
+    if (ext != ".TIF" && ext != ".TIFF") {
+        throw std::runtime_error("Invalid file extension " + ext);
+    }
+
+    TIFFHandle handle(lt::TIFFOpen(path.c_str(), mode), &lt::TIFFClose);
+    if (!handle) {
+        throw std::runtime_error("Failed to open file for writing");
+    }
+    return handle;
+}
+
+// Write a TIFF to a file
+void tio::WriteTIFF(
+    const fs::path& path, const cv::Mat& img, const WriteOptions& opts)
+{
+    // Safety checks
+    CheckImage(img, opts);
+
+    // Open the file
+    auto handle = OpenForWriting(path, "w");
+    WritePage(handle.get(), img, opts);
+
+    // Close the tiff. Flushes the last strip and the directory.
+    handle.reset();
+}
+
+// Get the OpenCV type of the image in a TIFF
+static int ImageType(lt::TIFF* in)
+{
+    uint16_t bitsPerSample{1};
+    uint16_t sampleFormat{SAMPLEFORMAT_UINT};
+    uint16_t channels{1};
+    uint16_t planar{PLANARCONFIG_CONTIG};
+    lt::TIFFGetFieldDefaulted(in, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+    lt::TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLEFORMAT, &sampleFormat);
+    lt::TIFFGetFieldDefaulted(in, TIFFTAG_SAMPLESPERPIXEL, &channels);
+    lt::TIFFGetFieldDefaulted(in, TIFFTAG_PLANARCONFIG, &planar);
+
+    if (planar != PLANARCONFIG_CONTIG) {
+        throw std::runtime_error("Unsupported planar configuration");
+    }
+    if (channels < 1 || channels > 4) {
+        throw std::runtime_error("Unsupported number of channels");
+    }
+
+    int depth{-1};
+    switch (sampleFormat) {
+        case SAMPLEFORMAT_UINT:
+            depth = bitsPerSample == 8    ? CV_8U
+                    : bitsPerSample == 16 ? CV_16U
+                                          : -1;
+            break;
+        case SAMPLEFORMAT_INT:
+            depth = bitsPerSample == 8    ? CV_8S
+                    : bitsPerSample == 16 ? CV_16S
+                    : bitsPerSample == 32 ? CV_32S
+                                          : -1;
+            break;
+        case SAMPLEFORMAT_IEEEFP:
+            depth = bitsPerSample == 32   ? CV_32F
+                    : bitsPerSample == 64 ? CV_64F
+                                          : -1;
+            break;
+        default:
+            break;
+    }
+    if (depth < 0) {
+        throw std::runtime_error(
+            "Unsupported sample format: " + std::to_string(sampleFormat) +
+            ", " + std::to_string(bitsPerSample) + " bits");
+    }
+
+    return CV_MAKETYPE(depth, channels);
+}
+
+// Decode the strips or tiles of an open TIFF which intersect a window
+static cv::Mat ReadRegion(lt::TIFF* in, const envitools::Box& region)
+{
+    uint32_t width{0};
+    uint32_t height{0};
+    lt::TIFFGetField(in, TIFFTAG_IMAGEWIDTH, &width);
+    lt::TIFFGetField(in, TIFFTAG_IMAGELENGTH, &height);
+    if (region.xmin < 0 || region.ymin < 0 || region.xmin >= region.xmax ||
+        region.ymin >= region.ymax ||
+        static_cast<uint32_t>(region.xmax) > width ||
+        static_cast<uint32_t>(region.ymax) > height) {
+        throw std::out_of_range(
+            "Region not in range: (" + std::to_string(region.xmin) + ", " +
+            std::to_string(region.ymin) + ", " + std::to_string(region.xmax) +
+            ", " + std::to_string(region.ymax) + ")");
+    }
+
+    cv::Mat output(
+        region.ymax - region.ymin, region.xmax - region.xmin, ImageType(in));
+    auto pixelBytes = output.elemSize();
+    auto x0 = static_cast<uint32_t>(region.xmin);
+    auto y0 = static_cast<uint32_t>(region.ymin);
+    auto x1 = static_cast<uint32_t>(region.xmax);
+    auto y1 = static_cast<uint32_t>(region.ymax);
+
+    // Size of each block. Strips cover every column.
+    uint32_t blockWidth{width};
+    uint32_t blockHeight{height};
+    auto tiled = lt::TIFFIsTiled(in) != 0;
+    std::vector<char> buffer;
+    if (tiled) {
+        lt::TIFFGetField(in, TIFFTAG_TILEWIDTH, &blockWidth);
+        lt::TIFFGetField(in, TIFFTAG_TILELENGTH, &blockHeight);
+        buffer.resize(static_cast<size_t>(lt::TIFFTileSize(in)));
+    } else {
+        lt::TIFFGetFieldDefaulted(in, TIFFTAG_ROWSPERSTRIP, &blockHeight);
+        blockHeight = std::min(blockHeight, height);
+        buffer.resize(static_cast<size_t>(lt::TIFFStripSize(in)));
+    }
+    if (blockWidth == 0 || blockHeight == 0) {
+        throw std::runtime_error("Invalid strip or tile size");
+    }
+    auto blockRowBytes = blockWidth * pixelBytes;
+
+    // Decode each intersecting block and copy the overlap
+    for (auto by = y0 - y0 % blockHeight; by < y1; by += blockHeight) {
+        for (auto bx = x0 - x0 % blockWidth; bx < x1; bx += blockWidth) {
+            auto length = static_cast<lt::tmsize_t>(buffer.size());
+            lt::tmsize_t result;
+            if (tiled) {
+                auto tile = lt::TIFFComputeTile(in, bx, by, 0, 0);
+                result =
+                    lt::TIFFReadEncodedTile(in, tile, buffer.data(), length);
+            } else {
+                auto strip = lt::TIFFComputeStrip(in, by, 0);
+                result =
+                    lt::TIFFReadEncodedStrip(in, strip, buffer.data(), length);
+            }
+            if (result == -1) {
+                auto msg = "Failed to read block at (" + std::to_string(bx) +
+                           ", " + std::to_string(by) + ")";
+                throw std::runtime_error(msg);
+            }
+
+            auto cx0 = std::max(bx, x0);
+            auto cx1 = std::min(bx + blockWidth, x1);
+            auto cy1 = std::min(by + blockHeight, y1);
+            for (auto y = std::max(by, y0); y < cy1; y++) {
+                std::memcpy(
+                    output.ptr(static_cast<int>(y - y0)) +
+                        (cx0 - x0) * pixelBytes,
+                    &buffer[(y - by) * blockRowBytes + (cx0 - bx) * pixelBytes],
+                    (cx1 - cx0) * pixelBytes);
+            }
         }
     }
 
-    // Close the tiff
-    lt::TIFFClose(out);
-}
\ No newline at end of file
+    // Match cv::imread()'s channel order
+    uint16_t photometric{PHOTOMETRIC_MINISBLACK};
+    lt::TIFFGetFieldDefaulted(in, TIFFTAG_PHOTOMETRIC, &photometric);
+    if (photometric == PHOTOMETRIC_RGB && output.channels() == 3) {
+        cv::cvtColor(output, output, cv::COLOR_RGB2BGR);
+    } else if (photometric == PHOTOMETRIC_RGB && output.channels() == 4) {
+        cv::cvtColor(output, output, cv::COLOR_RGBA2BGRA);
+    }
+
+    return output;
+}
+
+// Open a TIFF for reading and select a page
+static TIFFHandle OpenForReading(const fs::path& path, int page)
+{
+    TIFFHandle handle(lt::TIFFOpen(path.c_str(), "r"), &lt::TIFFClose);
+    if (!handle) {
+        throw std::runtime_error("Failed to open file: " + path.string());
+    }
+
+    // Directories are indexed by the offsets in the file, so pages of a
+    // stack can be read without decoding the ones before them
+    if (page != 0 && (page < 0 || page > UINT16_MAX ||
+                      lt::TIFFSetDirectory(
+                          handle.get(), static_cast<uint16_t>(page)) == 0)) {
+        throw std::out_of_range("Page not in file: " + std::to_string(page));
+    }
+    return handle;
+}
+
+// Read a whole TIFF
+cv::Mat tio::ReadTIFF(const fs::path& path, int page)
+{
+    auto handle = OpenForReading(path, page);
+    uint32_t width{0};
+    uint32_t height{0};
+    lt::TIFFGetField(handle.get(), TIFFTAG_IMAGEWIDTH, &width);
+    lt::TIFFGetField(handle.get(), TIFFTAG_IMAGELENGTH, &height);
+    Box all(0, 0, static_cast<int>(width), static_cast<int>(height));
+    return ReadRegion(handle.get(), all);
+}
+
+// Read a window of a TIFF
+cv::Mat tio::ReadTIFFRegion(
+    const fs::path& path, const Box& region, int page)
+{
+    auto handle = OpenForReading(path, page);
+    return ReadRegion(handle.get(), region);
+}
+
+// libtiff handle of a stack, kept out of the public header
+struct tio::StackWriter::Handle {
+    TIFFHandle tiff{nullptr, &lt::TIFFClose};
+};
+
+// Create a multi-page TIFF
+tio::StackWriter::StackWriter(
+    const fs::path& path, WriteOptions opts, bool bigTIFF)
+    : handle_{new Handle}, opts_{opts}
+{
+    CheckOptions(opts_);
+    handle_->tiff = OpenForWriting(path, bigTIFF ? "w8" : "w");
+}
+
+// Close the file, reporting errors
+tio::StackWriter::~StackWriter()
+{
+    try {
+        close();
+    } catch (const std::exception& e) {
+        std::cerr << "Error closing TIFF stack: " << e.what() << std::endl;
+    }
+}
+
+// Append a page to the stack
+void tio::StackWriter::writePage(
+    const cv::Mat& img, const std::string& description)
+{
+    if (!handle_->tiff) {
+        throw std::runtime_error("TIFF stack is closed");
+    }
+    CheckImage(img, opts_);
+
+    auto out = handle_->tiff.get();
+    lt::TIFFSetField(out, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+    // The total number of pages isn't known yet, which TIFF writes as 0
+    lt::TIFFSetField(out, TIFFTAG_PAGENUMBER, static_cast<int>(pages_), 0);
+    if (!description.empty()) {
+        lt::TIFFSetField(out, TIFFTAG_IMAGEDESCRIPTION, description.c_str());
+    }
+
+    WritePage(out, img, opts_);
+    if (lt::TIFFWriteDirectory(out) == 0) {
+        auto msg = "Failed to write page " + std::to_string(pages_);
+        throw std::runtime_error(msg);
+    }
+    pages_++;
+}
+
+// Flush the last page and close the file
+void tio::StackWriter::close()
+{
+    if (!handle_->tiff) {
+        return;
+    }
+    auto tiff = std::move(handle_->tiff);
+    if (lt::TIFFFlush(tiff.get()) == 0) {
+        throw std::runtime_error("Failed to flush TIFF stack");
+    }
+}